@@ -0,0 +1,191 @@
+/* coproc.c - long lived helper processes for smsh4
+ *
+ *    int builtinCoproc(char **argv)                 - the coproc builtin
+ *    char *coprocPath(char *file, int output)       - resolve a @NAME redirect
+ *
+ *      coproc NAME cmd [args ...]   start cmd with its stdin and stdout on pipes to the shell
+ *      coproc                       list the coprocesses
+ *      coproc -k NAME               close its pipes and wait for it to finish
+ *
+ *  later commands reach a coprocess by redirecting to or from its name,
+ *      echo 2+2 > @calc ; head -n 1 < @calc
+ *  "> @NAME" writes into its stdin and "< @NAME" reads what it has written.
+ *  the shell's ends of the pipes are close-on-exec, a command only gets one
+ *  when it opens the /dev/fd path of it between fork and exec, so no other
+ *  command holds the pipes open and the helper sees EOF when it is killed.
+ *  like any coprocess the helper must flush its output after every reply.
+ */
+
+#define _GNU_SOURCE
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <signal.h>
+#include    <string.h>
+#include    <fcntl.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+#define MAX_COPROCS 16
+#define FD_PATH_LEN 32
+
+struct coproc {
+    char *name;             // NULL for a free slot
+    char *cmd;              // for listing
+    pid_t pid;
+    int toFD, fromFD;       // shell's ends: its stdin, its stdout
+    char toPath[FD_PATH_LEN], fromPath[FD_PATH_LEN];
+    int done, status;       // it has exited, and how
+};
+
+static struct coproc coprocs[MAX_COPROCS];
+
+static struct coproc *findCoproc(char *name) {
+    int i;
+    for (i = 0; i < MAX_COPROCS; i++) {
+        if (coprocs[i].name != NULL && strcmp(coprocs[i].name, name) == 0)
+            return &coprocs[i];
+    }
+    return NULL;
+}
+
+/**
+ * notice a coprocess that has exited on its own
+*/
+static void pollCoproc(struct coproc *cp) {
+    if (!cp->done && waitpid(cp->pid, &cp->status, WNOHANG) == cp->pid)
+        cp->done = YES;
+}
+
+/**
+ * start cmd as coprocess name
+ * @return status as returned via wait
+*/
+static int startCoproc(char *name, char **argv) {
+    struct coproc *cp = NULL;
+    int toChild[2], fromChild[2];
+    int i;
+    size_t len = 0;
+
+    if ((cp = findCoproc(name)) != NULL) {
+        pollCoproc(cp);
+        if (!cp->done) {
+            fprintf(stderr, "coproc: %s is already running\n", name);
+            return EXIT_STATUS(1);
+        }
+        fprintf(stderr, "coproc: %s has finished, close it with coproc -k %s first\n", name, name);
+        return EXIT_STATUS(1);
+    }
+    for (i = 0; i < MAX_COPROCS && cp == NULL; i++) {
+        if (coprocs[i].name == NULL)
+            cp = &coprocs[i];
+    }
+    if (cp == NULL) {
+        fprintf(stderr, "coproc: too many coprocesses, at most %d\n", MAX_COPROCS);
+        return EXIT_STATUS(1);
+    }
+
+    if (pipe2(toChild, O_CLOEXEC) == -1 || pipe2(fromChild, O_CLOEXEC) == -1) {
+        perror("coproc: pipe");
+        return -1;
+    }
+    setPipeSize(toChild[1], pipeSize);
+    setPipeSize(fromChild[1], pipeSize);
+
+    // in a group of its own, ^C at the prompt is for the command in front, not the helpers
+    if ((cp->pid = spawnChild(argv, toChild[0], fromChild[1], NULL, NULL, -1, YES)) == -1) {
+        close(toChild[0]);
+        close(toChild[1]);
+        close(fromChild[0]);
+        close(fromChild[1]);
+        return -1;
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+
+    cp->toFD = toChild[1];
+    cp->fromFD = fromChild[0];
+    snprintf(cp->toPath, FD_PATH_LEN, "/dev/fd/%d", cp->toFD);
+    snprintf(cp->fromPath, FD_PATH_LEN, "/dev/fd/%d", cp->fromFD);
+    cp->done = NO;
+    cp->status = 0;
+    cp->name = estrndup(name, strlen(name));
+    for (i = 0; argv[i] != NULL; i++)
+        len += strlen(argv[i]) + 1;
+    cp->cmd = ecalloc(len + 1, 1);
+    for (i = 0; argv[i] != NULL; i++) {
+        if (i > 0)
+            strcat(cp->cmd, " ");
+        strcat(cp->cmd, argv[i]);
+    }
+    return 0;
+}
+
+/**
+ * close a coprocess's pipes and wait for it
+ * @return its status as returned via wait
+*/
+static int killCoproc(char *name) {
+    struct coproc *cp = findCoproc(name);
+    if (cp == NULL) {
+        fprintf(stderr, "coproc: no coprocess %s\n", name);
+        return EXIT_STATUS(1);
+    }
+    close(cp->toFD); // EOF on its stdin is the signal to finish
+    close(cp->fromFD);
+    if (!cp->done && waitpid(cp->pid, &cp->status, 0) == -1) {
+        perror("wait");
+        cp->status = -1;
+    }
+    efree(cp->name);
+    efree(cp->cmd);
+    cp->name = NULL;
+    return cp->status;
+}
+
+/**
+ * coproc builtin, see the top of the file
+ * @return status as returned via wait
+*/
+int builtinCoproc(char **argv) {
+    int i;
+
+    if (argv[1] == NULL) {
+        for (i = 0; i < MAX_COPROCS; i++) {
+            struct coproc *cp = &coprocs[i];
+            if (cp->name == NULL)
+                continue;
+            pollCoproc(cp);
+            if (cp->done)
+                printf("%-12s %-8d done (%d)  %s\n", cp->name, (int) cp->pid, exitCode(cp->status), cp->cmd);
+            else
+                printf("%-12s %-8d running   %s\n", cp->name, (int) cp->pid, cp->cmd);
+        }
+        fflush(stdout);
+        return 0;
+    }
+    if (strcmp(argv[1], "-k") == 0 && argv[2] != NULL && argv[3] == NULL)
+        return killCoproc(argv[2]);
+    if (argv[1][0] == '-' || argv[2] == NULL) {
+        fprintf(stderr, "usage: coproc [NAME cmd [args ...] | -k NAME]\n");
+        return EXIT_STATUS(2);
+    }
+    return startCoproc(argv[1], argv + 2);
+}
+
+/**
+ * the file a redirect really opens, @NAME is the pipe to or from coprocess NAME
+ * @param file - redirect file as typed, may be NULL
+ * @param output - YES for a > redirect, NO for <
+ * @return file itself if it isn't a coprocess, NULL (after saying why) for an unknown one
+*/
+char *coprocPath(char *file, int output) {
+    struct coproc *cp;
+    if (file == NULL || file[0] != '@')
+        return file;
+    if ((cp = findCoproc(file + 1)) == NULL) {
+        fprintf(stderr, "Error: no coprocess %s\n", file + 1);
+        return NULL;
+    }
+    return output ? cp->toPath : cp->fromPath;
+}
@@ -1,5 +1,6 @@
 /* execute.c - code used by small shell to execute commands */
 
+#define _GNU_SOURCE
 #include    <stdio.h>
 #include    <stdlib.h>
 #include    <unistd.h>
@@ -9,6 +10,204 @@
 #include    "smsh.h"
 #include    <fcntl.h>
 #include    <sys/stat.h>
+#include    <sys/resource.h>
+
+int pipeSize = 0; // capacity for the pipes we create, 0 keeps the system default
+
+/**
+ * set the capacity of a pipe with F_SETPIPE_SZ where the system has it
+ * @param fd - either end of the pipe
+ * @param size - capacity in bytes, 0 or less leaves the pipe alone
+*/
+void setPipeSize(int fd, int size) {
+#ifdef F_SETPIPE_SZ
+    if (size > 0 && fcntl(fd, F_SETPIPE_SZ, size) == -1)
+        perror("F_SETPIPE_SZ");
+#endif
+}
+
+/**
+ * make a pipe with both ends close-on-exec, pipe2 where the system has it
+ * @return 0, or -1 with errno set
+*/
+static int cloexecPipe(int fds[2]) {
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) == -1)
+        return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+int argBatchJobs = 1; // how many batches of an oversized argv run at once
+
+extern char **environ;
+
+#define ARG_HEADROOM 2048 // what xargs leaves spare below ARG_MAX
+
+/**
+ * bytes execve needs to pass an argument, the string and its pointer
+*/
+static size_t argBytes(char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * how many bytes of arguments one execvp can take, after the environment
+*/
+static size_t argLimit() {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t envBytes = 0;
+    char **ep;
+
+    if (max <= 0)
+        max = 131072; // the old fixed limit, safe everywhere
+    for (ep = environ; *ep != NULL; ep++)
+        envBytes += argBytes(*ep);
+    if (envBytes + ARG_HEADROOM >= (size_t) max)
+        return 0;
+    return max - envBytes - ARG_HEADROOM;
+}
+
+/**
+ * fork and exec one command, every command the shell runs is started here
+ * the child gets default signals, its redirects, the limits and sched settings
+ * @param inFD, outFD - become its stdin and stdout, -1 leaves them alone
+ * @param inFile, outFile - redirect files opened in the child instead, may be NULL
+ * @param stage - which stage of a pipeline this is, -1 for anything else
+ * @param newGroup - YES to put it in a process group of its own
+ * @return pid of the child, -1 if fork failed
+*/
+int spawnChild(char **argv, int inFD, int outFD, char *inFile, char *outFile, int stage, int newGroup) {
+    int pid;
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0)
+        return pid;
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL); // the shell ignores it while relaying
+    if (newGroup)
+        setpgid(0, 0);
+    if (inFile != NULL && (inFD = open(inFile, O_RDONLY)) == -1) { // input is only ever read
+        perror(inFile);
+        _exit(1);
+    }
+    // write only, a reader's end (a coprocess's /dev/fd pipe) would keep us from seeing EPIPE
+    if (outFile != NULL && (outFD = open(outFile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        perror(outFile);
+        _exit(1);
+    }
+    // the fds we were given are close-on-exec or closed here, only 0 and 1 stay
+    if (inFD != -1 && inFD != STDIN_FILENO) {
+        dup2(inFD, STDIN_FILENO);
+        close(inFD);
+    }
+    if (outFD != -1 && outFD != STDOUT_FILENO) {
+        dup2(outFD, STDOUT_FILENO);
+        close(outFD);
+    }
+    applyLimits();
+    argv = applySched(argv, stage);
+    execvp(argv[0], argv);
+    perror("cannot execute command");
+    _exit(1); // exit would flush the shell's stdio again, rereading a script on stdin
+}
+
+/**
+ * run a command whose argv is too big for one execvp, the way xargs does:
+ * the command and its leading -options are repeated for every batch and
+ * the remaining arguments are split so each batch fits in ARG_MAX.
+ * argBatchJobs batches run at the same time, redirect files are opened
+ * once so the batches share them
+ * returns: the status of the last batch that failed, else of the last batch
+ */
+static int executeBatched(char *argv[], char *inFile, char *outFile, size_t limit) {
+    int argc, fixed, next;
+    int inFD = -1, outFD = -1;
+    int child_info = 0, status;
+    int jobs = argBatchJobs > 0 ? argBatchJobs : 1;
+    pid_t running[jobs];
+    int numRunning = 0, oldest = 0;
+    size_t fixedBytes = 0;
+
+    for (argc = 0; argv[argc] != NULL; argc++)
+        ;
+    // a sched prefix and the command, then its options up to and including a --
+    for (fixed = schedWords(argv) + 1; fixed < argc && argv[fixed][0] == '-'; fixed++) {
+        if (strcmp(argv[fixed], "--") == 0) {
+            fixed++;
+            break;
+        }
+    }
+    for (next = 0; next < fixed; next++)
+        fixedBytes += argBytes(argv[next]);
+
+    if (inFile != NULL && (inFD = open(inFile, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(inFile);
+        return -1;
+    }
+    if (outFile != NULL && (outFD = open(outFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        perror(outFile);
+        if (inFD != -1)
+            close(inFD);
+        return -1;
+    }
+
+    char *batch[argc + 1];
+    memcpy(batch, argv, sizeof(char *) * fixed);
+
+    next = fixed;
+    while (next < argc || numRunning > 0) {
+        if (next < argc && numRunning < jobs) {
+            size_t bytes = fixedBytes + sizeof(char *); // room for the terminating NULL
+            int n = fixed;
+            // always take one, a single argument that is too big fails in execvp
+            do {
+                bytes += argBytes(argv[next]);
+                batch[n++] = argv[next++];
+            } while (next < argc && bytes + argBytes(argv[next]) <= limit);
+            batch[n] = NULL;
+
+            pid_t pid = spawnChild(batch, inFD, outFD, NULL, NULL, -1, NO);
+            if (pid == -1) {
+                child_info = -1;
+                break;
+            }
+            running[(oldest + numRunning++) % jobs] = pid;
+            continue;
+        }
+        // all slots busy or nothing left to start, wait for the oldest batch
+        struct rusage ru;
+        if (wait4(running[oldest], &status, 0, &ru) == -1) {
+            perror("wait");
+            status = -1;
+        } else {
+            reportLimits(status, &ru);
+        }
+        if (status != 0 || child_info == 0)
+            child_info = status;
+        oldest = (oldest + 1) % jobs;
+        numRunning--;
+    }
+    while (numRunning > 0) { // only left over if a fork failed
+        waitpid(running[oldest], NULL, 0);
+        oldest = (oldest + 1) % jobs;
+        numRunning--;
+    }
+
+    if (inFD != -1)
+        close(inFD);
+    if (outFD != -1)
+        close(outFD);
+    return child_info;
+}
 
 int execute(char *argv[], char *inFile, char *outFile)
 /*
@@ -20,40 +219,23 @@ int execute(char *argv[], char *inFile, char *outFile)
 {
     int pid;
     int child_info = -1;
-    int inFD, outFD;
 
     if (argv[0] == NULL)        /* nothing succeeds	*/
         return 0;
 
-    if ((pid = fork()) == -1)
-        perror("fork");
-    else if (pid == 0) {
-        if (inFile != NULL || outFile != NULL) { // if we have a file to redirect
-            if (inFile != NULL) {
-                inFD = open(inFile, O_RDWR | O_CREAT);
-                fchmod(inFD, 0777);
-            }
-            if (outFile != NULL) {
-                outFD = open(outFile, O_RDWR | O_CREAT);
-                fchmod(outFD, 0777); // allows read/write permissions for fileRedir (macOS specific issue I believe)
-            }
-        }
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        if (inFile != NULL) {
-            dup2(inFD, STDIN_FILENO);
-            close(inFD);
-        }
-        if (outFile != NULL) {
-            dup2(outFD, STDOUT_FILENO);
-            close(outFD);
-        }
-        execvp(argv[0], argv);
-        perror("cannot execute command");
-        exit(1);
-    } else {
-        if (wait(&child_info) == -1)
+    size_t bytes = sizeof(char *), limit = argLimit();
+    int i;
+    for (i = 0; argv[i] != NULL; i++)
+        bytes += argBytes(argv[i]);
+    if (bytes > limit)          /* too big for one exec, split it up */
+        return executeBatched(argv, inFile, outFile, limit);
+
+    if ((pid = spawnChild(argv, -1, -1, inFile, outFile, -1, NO)) != -1) {
+        struct rusage ru;
+        if (wait4(pid, &child_info, 0, &ru) == -1)
             perror("wait");
+        else
+            reportLimits(child_info, &ru);
     }
     return child_info;
 }
@@ -61,13 +243,15 @@ int execute(char *argv[], char *inFile, char *outFile)
 
 /**
  * Execute command to run if the cmdline contains a pipe
+ * every stage is started before any is waited for, they run side by side
+ * @return status of the last stage as returned via wait
 */
 int executePipe(char ***pipeCmds, int numCommands, char *inFiles[], char *outFiles[], const char redirPos[]) {
-    pid_t pid; // process ID's
-    int child_info = -1;
-    int newPipe[2], prevPipe[2];
+    pid_t pids[numCommands]; // process ID's
+    int child_info = -1, status;
+    int newPipe[2];
     int currCommand = 0;
-    int inFD, outFD;
+    int inFD = -1; // read end of the previous stage's pipe
 
     // if there are less than 2 commands, there is no pipe
     if (numCommands < 2) {
@@ -86,90 +270,58 @@ int executePipe(char ***pipeCmds, int numCommands, char *inFiles[], char *outFil
     }
 
     while (currCommand < numCommands) {
+        int outFD = -1;
+        char redir = redirPos != NULL ? redirPos[currCommand] : '\0';
         // if this is not last command
         if (currCommand != numCommands - 1) {
-            if (pipe(newPipe) == -1) {
+            if (cloexecPipe(newPipe) == -1) {
                 perror("Issue with pipe");
                 exit(1);
             }
+            setPipeSize(newPipe[1], pipeSize);
+            outFD = newPipe[1];
         }
 
-        // fork
-        if ((pid = fork()) == -1) {
-            perror("Fork failed");
+        if ((pids[currCommand] = spawnChild(pipeCmds[currCommand], inFD, outFD,
+                                            redir == '<' ? inFiles[currCommand] : NULL,
+                                            redir == '>' ? outFiles[currCommand] : NULL, currCommand, NO)) == -1)
             exit(1);
-        }
 
-            // Parent Process
-        else if (pid > 0) {
-            // if this is not first command
-            if (currCommand != 0) {
-                close(prevPipe[0]);
-                close(prevPipe[1]);
-            }
-            // if this is not final command
-            if (currCommand != numCommands - 1) {
-                prevPipe[0] = newPipe[0];
-                prevPipe[1] = newPipe[1];
-            }
-            // wait for child
-            if (wait(&child_info) == -1) {
-                perror("wait issue");
-            }
-            currCommand++;
+        // the child has its ends now, keep only the read end for the next stage
+        if (inFD != -1)
+            close(inFD);
+        if (outFD != -1) {
+            close(outFD);
+            inFD = newPipe[0];
         }
+        currCommand++;
+    }
 
-            // Child Process
-        else {
-            signal(SIGINT, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
-
-            // not first command
-            if (currCommand != 0) {
-                close(prevPipe[1]); // close writing end
-                dup2(prevPipe[0], 0); // redirect stdin
-            }
-            // not last command
-            if (currCommand != numCommands - 1) {
-                close(newPipe[0]); // close reading end
-                dup2(newPipe[1], 1); // redirect stdout
-            }
-
-            if (redirPos != NULL) {
-                if (redirPos[currCommand] != '\0') {
-                    // if redirect is input
-                    if (redirPos[currCommand] == '>') {
-                        outFD = open(outFiles[currCommand], O_RDWR | O_CREAT);
-                        fchmod(outFD, 0777);
-                        dup2(outFD, STDOUT_FILENO);
-                        dup2(newPipe[1], outFD);
-                    }
-                        // if redirect is output
-                    else if (redirPos[currCommand] == '<') {
-                        inFD = open(inFiles[currCommand], O_RDWR | O_CREAT);
-                        fchmod(inFD, 0777);
-                        dup2(inFD, STDIN_FILENO);
-                        dup2(newPipe[0], inFD);
-                    }
-                }
-            }
-            // if curr command has redirect
-
-
-            // execute
-            execvp(pipeCmds[currCommand][0], pipeCmds[currCommand]);
-
-            // if exec fail
-            perror("Issue executing");
-            exit(1);
+    // only now that every stage is running, waiting on one would stall the
+    // stages before it once their pipe fills
+    for (i = 0; i < numCommands; i++) {
+        struct rusage ru;
+        if (wait4(pids[i], &status, 0, &ru) == -1) {
+            perror("wait issue");
+            continue;
         }
+        reportLimits(status, &ru);
+        if (i == numCommands - 1)
+            child_info = status;
     }
 
-    // cleanup
-    close(newPipe[0]);
-    close(newPipe[1]);
-    close(prevPipe[0]);
-    close(prevPipe[1]);
-
     return child_info;
-}
\ No newline at end of file
+}
+
+/**
+ * turn a status returned via wait into a shell style exit code
+ * @param status - status from execute/executePipe, -1 on error
+ * @return exit code of the child, 128 + signal if it was killed
+*/
+int exitCode(int status) {
+    if (status == -1)
+        return 1;
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,204 @@
+/* fanout.c - the |> operator for smsh4
+ *
+ *    int executeFanout(char ***cmds, int numCommands) - run cmd |> a |> b ...
+ *
+ *  the output of the first command is duplicated to every other command.
+ *  the shell relays it itself with tee(2) and splice(2), so the data is only
+ *  ever moved between pipe buffers inside the kernel: it is never copied into
+ *  user space and no external tee process is needed.
+ *
+ *  relay, for consumers c0..cn:
+ *      producer -> src --tee--> c0
+ *                   `--splice--> hop1 --tee--> c1
+ *                                 `--splice--> hop2 ... --splice--> cn
+ *  tee duplicates data without consuming it, the splice behind it then moves
+ *  exactly the bytes that were duplicated on to the next hop.
+ */
+
+#define _GNU_SOURCE
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <signal.h>
+#include    <errno.h>
+#include    <fcntl.h>
+#include    <limits.h>
+#include    <poll.h>
+#include    <sys/ioctl.h>
+#include    <sys/resource.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+/**
+ * move exactly n bytes from one pipe to another
+ * @return number of bytes that could not be moved, errno is set if that isn't 0
+*/
+static size_t spliceAll(int from, int to, size_t n) {
+    ssize_t moved;
+    while (n > 0) {
+        if ((moved = splice(from, NULL, to, NULL, n, SPLICE_F_MOVE)) <= 0) {
+            if (moved == -1 && errno == EINTR)
+                continue;
+            if (moved == 0)
+                errno = EPIPE;
+            break;
+        }
+        n -= moved;
+    }
+    return n;
+}
+
+/**
+ * run cmds[0] and relay its output to each of cmds[1..numCommands-1]
+ * @return status of the last consumer as returned via wait, -1 on error
+*/
+int executeFanout(char ***cmds, int numCommands) {
+    int numConsumers = numCommands - 1;
+    int src[2];
+    int out[numConsumers][2]; // consumer i reads out[i][0]
+    int hop[numConsumers][2]; // hop[i] carries the stream to tee i, hop[0] is unused
+    pid_t pids[numCommands];
+    int dead[numConsumers];   // consumer exited early, its share is dropped
+    int live = numConsumers;  // consumers not dead yet
+    int child_info = -1, status;
+    int devNull;
+    int i;
+
+    if (numConsumers < 1) {
+        fprintf(stderr, "Error: |> needs a command on both sides\n");
+        return -1;
+    }
+    for (i = 0; i < numCommands; i++) {
+        if (cmds[i] == NULL || cmds[i][0] == NULL) {
+            fprintf(stderr, "Error: empty command around |>\n");
+            return -1;
+        }
+    }
+
+    if (pipe2(src, O_CLOEXEC) == -1) {
+        perror("Issue with pipe");
+        exit(1);
+    }
+    for (i = 0; i < numConsumers; i++) {
+        dead[i] = NO;
+        hop[i][0] = hop[i][1] = -1;
+        if (pipe2(out[i], O_CLOEXEC) == -1 || (i > 0 && pipe2(hop[i], O_CLOEXEC) == -1)) {
+            perror("Issue with pipe");
+            exit(1);
+        }
+        setPipeSize(out[i][1], pipeSize);
+        if (i > 0)
+            setPipeSize(hop[i][1], pipeSize);
+    }
+    setPipeSize(src[1], pipeSize);
+    devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    pids[0] = spawnChild(cmds[0], -1, src[1], NULL, NULL, 0, NO);
+    close(src[1]);
+    for (i = 0; i < numConsumers; i++) {
+        pids[i + 1] = spawnChild(cmds[i + 1], out[i][0], -1, NULL, NULL, i + 1, NO);
+        close(out[i][0]);
+    }
+
+    // a consumer that quits early must not kill the shell
+    void (*oldPipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd pfd;
+    pfd.fd = src[0];
+    pfd.events = POLLIN;
+    for (;;) {
+        int avail = 0;
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (ioctl(src[0], FIONREAD, &avail) == -1) {
+            perror("ioctl");
+            break;
+        }
+        if (avail == 0) {
+            if (pfd.revents & (POLLHUP | POLLERR))
+                break; // producer is done
+            continue;
+        }
+
+        // push this round's bytes down the chain, every hop starts out empty
+        for (i = 0; i < numConsumers; i++) {
+            int from = (i == 0) ? src[0] : hop[i][0];
+            size_t remaining = avail;
+
+            if (i == numConsumers - 1) { // last one gets the bytes themselves
+                size_t left = remaining;
+                if (!dead[i]) {
+                    left = spliceAll(from, out[i][1], remaining);
+                    if (left > 0 && errno != EPIPE) {
+                        perror("splice");
+                        goto done;
+                    }
+                    if (left > 0) {
+                        dead[i] = YES;
+                        live--;
+                    }
+                }
+                if (left > 0 && spliceAll(from, devNull, left) > 0) {
+                    perror("splice");
+                    goto done;
+                }
+                break;
+            }
+            while (remaining > 0) {
+                ssize_t copied = remaining;
+                if (!dead[i]) {
+                    copied = tee(from, out[i][1], remaining, 0);
+                    if (copied == -1) {
+                        if (errno == EINTR)
+                            continue;
+                        if (errno != EPIPE) {
+                            perror("tee");
+                            goto done;
+                        }
+                        dead[i] = YES;
+                        live--;
+                        copied = remaining;
+                    }
+                }
+                if (spliceAll(from, hop[i + 1][1], copied) > 0) {
+                    perror("splice");
+                    goto done;
+                }
+                remaining -= copied;
+            }
+        }
+        if (live == 0)
+            break; // nobody is reading, closing src lets the producer see EPIPE
+    }
+
+done:
+    close(src[0]);
+    for (i = 0; i < numConsumers; i++) {
+        close(out[i][1]);
+        if (i > 0) {
+            close(hop[i][0]);
+            close(hop[i][1]);
+        }
+    }
+    if (devNull != -1)
+        close(devNull);
+    signal(SIGPIPE, oldPipe);
+
+    for (i = 0; i < numCommands; i++) {
+        struct rusage ru;
+        if (pids[i] <= 0)
+            continue;
+        if (wait4(pids[i], &status, 0, &ru) == -1) {
+            perror("wait");
+            continue;
+        }
+        reportLimits(status, &ru);
+        if (i == numCommands - 1)
+            child_info = status;
+    }
+    return child_info;
+}
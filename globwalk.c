@@ -0,0 +1,571 @@
+/* globwalk.c - native glob engine for smsh
+ *
+ *    char **globWalk(char *pattern, int *count) - sorted, NULL terminated list of matches
+ *    void freeGlobWalk(char **matches)          - free that list
+ *
+ *  supports *, ?, [...] (with ! or ^ to negate, and ranges), \ escapes and a
+ *  path segment of ** matching any number of directories. like glob(3) a
+ *  wildcard never matches a leading '.', and ** doesn't descend into hidden
+ *  directories or follow symlinks to directories.
+ *
+ *  every path segment is compiled once into a small list of match ops. the
+ *  tree is walked by a pool of threads: each has a deque of directories to
+ *  read, works from the bottom of its own and steals from the top of the
+ *  others' when it runs out. directories are read with openat/getdents64.
+ *  results are collected per thread and sorted once at the end.
+ *
+ *  SMSH_GLOB_THREADS in the environment overrides the number of threads.
+ */
+
+#define _GNU_SOURCE
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <stdint.h>
+#include    <unistd.h>
+#include    <fcntl.h>
+#include    <dirent.h>
+#include    <errno.h>
+#include    <time.h>
+#include    <pthread.h>
+#include    <sys/stat.h>
+#include    <sys/syscall.h>
+#include    "smsh.h"
+
+#define OP_CHAR  0 // one literal character
+#define OP_ANY   1 // ?
+#define OP_STAR  2 // *
+#define OP_CLASS 3 // [...]
+
+#define MAX_WALKERS 64
+#define IDLE_WAIT_NS 2000000 // idle threads recheck for work this often
+#define DENTS_BUF 65536
+
+struct op {
+    int type;
+    unsigned char c;
+    unsigned char set[32]; // bitmap of the characters a class matches
+};
+
+struct segment {
+    int literal;  // no wildcards, text is the name to look up
+    int globstar; // the segment is **
+    char *text;   // unescaped name for literal segments
+    struct op *ops;
+    int numOps;
+};
+
+struct pattern {
+    char *root;   // directory the walk starts in, "" for the current one
+    int dirOnly;  // pattern ended with '/', only directories match
+    struct segment *segs;
+    int numSegs;
+};
+
+struct task {
+    char *path;   // directory to look in
+    int seg;      // segment to match against its entries
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct task *tasks;
+    int head, tail, cap; // owner works at the tail, thieves take from the head
+};
+
+struct walker;
+
+struct worker {
+    struct walker *walk;
+    struct deque dq;
+    char **results;
+    int numResults, capResults;
+    pthread_t thread;
+};
+
+struct walker {
+    struct pattern *pat;
+    struct worker *workers;
+    int numWorkers;
+    long pending;  // tasks pushed but not yet finished
+    int sleepers;  // workers waiting for something to steal
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+};
+
+/**
+ * compile one path segment of the pattern into match ops
+*/
+static void compileSegment(struct segment *seg, const char *text, int len) {
+    int i, n = 0;
+
+    seg->ops = emalloc(sizeof(struct op) * (len + 1));
+    seg->text = emalloc(len + 1);
+    seg->literal = YES;
+    seg->globstar = (len == 2 && text[0] == '*' && text[1] == '*');
+
+    for (i = 0; i < len; i++) {
+        struct op *op = &seg->ops[n];
+        if (text[i] == '\\' && i + 1 < len) {
+            op->type = OP_CHAR;
+            op->c = text[++i];
+        } else if (text[i] == '?') {
+            op->type = OP_ANY;
+        } else if (text[i] == '*') {
+            op->type = OP_STAR;
+            while (i + 1 < len && text[i + 1] == '*')
+                i++;
+        } else if (text[i] == '[' && (strchr(text + i + 1, ']') != NULL) && strchr(text + i + 1, ']') < text + len) {
+            int j = i + 1, negate = NO, b;
+            memset(op->set, 0, sizeof(op->set));
+            if (text[j] == '!' || text[j] == '^') {
+                negate = YES;
+                j++;
+            }
+            do { // a ']' straight after the opening bracket is a member
+                unsigned char lo = text[j], hi = lo;
+                if (j + 2 < len && text[j + 1] == '-' && text[j + 2] != ']') {
+                    hi = text[j + 2];
+                    j += 2;
+                }
+                for (b = lo; b <= hi; b++)
+                    op->set[b / 8] |= 1 << (b % 8);
+                j++;
+            } while (j < len && text[j] != ']');
+            if (j >= len) { // never closed, the bracket is just a character
+                op->type = OP_CHAR;
+                op->c = '[';
+            } else {
+                if (negate)
+                    for (b = 0; b < 32; b++)
+                        op->set[b] = ~op->set[b];
+                op->type = OP_CLASS;
+                i = j;
+            }
+        } else {
+            op->type = OP_CHAR;
+            op->c = text[i];
+        }
+        if (op->type != OP_CHAR)
+            seg->literal = NO;
+        n++;
+    }
+    seg->numOps = n;
+
+    // a literal segment is looked up directly, keep its unescaped name
+    for (i = 0; seg->literal && i < n; i++)
+        seg->text[i] = seg->ops[i].c;
+    seg->text[seg->literal ? n : 0] = '\0';
+}
+
+/**
+ * split a pattern into segments and compile each of them
+*/
+static struct pattern *compilePattern(const char *text) {
+    struct pattern *pat = emalloc(sizeof(struct pattern));
+    int len = strlen(text);
+    const char *cp = text, *end = text + len;
+
+    pat->segs = emalloc(sizeof(struct segment) * (len / 2 + 2));
+    pat->numSegs = 0;
+    pat->root = estrndup(text[0] == '/' ? "/" : "", 1);
+    pat->dirOnly = (len > 0 && text[len - 1] == '/');
+
+    while (cp < end) {
+        const char *slash = cp;
+        while (slash < end && *slash != '/')
+            slash++;
+        if (slash > cp) {
+            struct segment *seg = &pat->segs[pat->numSegs];
+            compileSegment(seg, cp, slash - cp);
+            // **/** is the same as **
+            if (seg->globstar && pat->numSegs > 0 && pat->segs[pat->numSegs - 1].globstar) {
+                efree(seg->ops);
+                efree(seg->text);
+            } else {
+                pat->numSegs++;
+            }
+        }
+        cp = slash + 1;
+    }
+    return pat;
+}
+
+static void freePattern(struct pattern *pat) {
+    int i;
+    for (i = 0; i < pat->numSegs; i++) {
+        efree(pat->segs[i].ops);
+        efree(pat->segs[i].text);
+    }
+    efree(pat->segs);
+    efree(pat->root);
+    efree(pat);
+}
+
+static int opMatches(const struct op *op, unsigned char c) {
+    switch (op->type) {
+        case OP_CHAR:
+            return op->c == c;
+        case OP_ANY:
+            return YES;
+        case OP_CLASS:
+            return (op->set[c / 8] >> (c % 8)) & 1;
+    }
+    return NO;
+}
+
+/**
+ * match a name against a compiled segment, backtracking to the last * only
+*/
+static int matchSegment(const struct segment *seg, const char *name) {
+    const struct op *ops = seg->ops;
+    int n = seg->numOps, pi = 0, starOp = -1;
+    const char *starName = NULL;
+
+    if (name[0] == '.' && (n == 0 || ops[0].type != OP_CHAR))
+        return NO; // wildcards never match a leading dot
+
+    while (*name != '\0') {
+        if (pi < n && ops[pi].type == OP_STAR) {
+            starOp = pi++;
+            starName = name;
+        } else if (pi < n && opMatches(&ops[pi], *name)) {
+            pi++;
+            name++;
+        } else if (starOp >= 0) {
+            pi = starOp + 1;
+            name = ++starName;
+        } else {
+            return NO;
+        }
+    }
+    while (pi < n && ops[pi].type == OP_STAR)
+        pi++;
+    return pi == n;
+}
+
+static char *joinPath(const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    int slash = (dlen > 0 && dir[dlen - 1] != '/');
+    char *path = emalloc(dlen + slash + nlen + 1);
+    memcpy(path, dir, dlen);
+    if (slash)
+        path[dlen] = '/';
+    memcpy(path + dlen + slash, name, nlen + 1);
+    return path;
+}
+
+static void addResult(struct worker *self, char *path) {
+    if (self->numResults == self->capResults) {
+        self->capResults = self->capResults ? self->capResults * 2 : 64;
+        self->results = erealloc(self->results, sizeof(char *) * self->capResults);
+    }
+    self->results[self->numResults++] = path;
+}
+
+/**
+ * queue a directory on our own deque, waking a sleeping thread to steal it
+*/
+static void push(struct worker *self, char *path, int seg) {
+    struct deque *dq = &self->dq;
+    struct walker *walk = self->walk;
+
+    __atomic_add_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        if (dq->head > 0) { // slide down what the thieves left behind
+            memmove(dq->tasks, dq->tasks + dq->head, sizeof(struct task) * (dq->tail - dq->head));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        if (dq->tail == dq->cap) {
+            dq->cap = dq->cap ? dq->cap * 2 : 64;
+            dq->tasks = erealloc(dq->tasks, sizeof(struct task) * dq->cap);
+        }
+    }
+    dq->tasks[dq->tail].path = path;
+    dq->tasks[dq->tail].seg = seg;
+    dq->tail++;
+    pthread_mutex_unlock(&dq->lock);
+
+    if (__atomic_load_n(&walk->sleepers, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_signal(&walk->idleCond);
+}
+
+/**
+ * take a task from the bottom of our deque, or else the top of somebody else's
+*/
+static int take(struct worker *self, struct task *t) {
+    struct walker *walk = self->walk;
+    int i, start = self - walk->workers;
+
+    for (i = 0; i < walk->numWorkers; i++) {
+        struct deque *dq = &walk->workers[(start + i) % walk->numWorkers].dq;
+        int found = NO;
+        pthread_mutex_lock(&dq->lock);
+        if (dq->head < dq->tail) {
+            *t = (i == 0) ? dq->tasks[--dq->tail] : dq->tasks[dq->head++];
+            if (dq->head == dq->tail)
+                dq->head = dq->tail = 0;
+            found = YES;
+        }
+        pthread_mutex_unlock(&dq->lock);
+        if (found)
+            return YES;
+    }
+    return NO;
+}
+
+/**
+ * is path (relative to the directory fd) a directory
+ * @param follow - follow a symlink to a directory
+*/
+static int isDirectory(int dirFD, const char *name, unsigned char type, int follow) {
+    struct stat st;
+    if (type == DT_DIR)
+        return YES;
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow))
+        return NO;
+    if (fstatat(dirFD, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == -1)
+        return NO;
+    return S_ISDIR(st.st_mode);
+}
+
+/**
+ * match one directory entry against the segment the task is on
+*/
+static void visitEntry(struct worker *self, struct task *t, int dirFD, const char *name, unsigned char type) {
+    struct pattern *pat = self->walk->pat;
+    struct segment *seg = &pat->segs[t->seg];
+    int last = (t->seg == pat->numSegs - 1);
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        return;
+
+    if (seg->globstar) {
+        if (name[0] == '.')
+            return;
+        int dir = isDirectory(dirFD, name, type, NO);
+        if (last && (dir || !pat->dirOnly))
+            addResult(self, joinPath(t->path, name));
+        if (dir)
+            push(self, joinPath(t->path, name), t->seg);
+        return;
+    }
+
+    if (!matchSegment(seg, name))
+        return;
+    if (last) {
+        if (!pat->dirOnly || isDirectory(dirFD, name, type, YES))
+            addResult(self, joinPath(t->path, name));
+    } else if (isDirectory(dirFD, name, type, YES)) {
+        push(self, joinPath(t->path, name), t->seg + 1);
+    }
+}
+
+#ifdef SYS_getdents64
+struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/**
+ * read every entry of the task's directory
+*/
+static void readDirectory(struct worker *self, struct task *t) {
+    int dirFD = openat(AT_FDCWD, t->path[0] ? t->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFD == -1)
+        return;
+
+#ifdef SYS_getdents64
+    char buf[DENTS_BUF];
+    long n, pos;
+    while ((n = syscall(SYS_getdents64, dirFD, buf, sizeof(buf))) > 0) {
+        for (pos = 0; pos < n;) {
+            struct linuxDirent64 *d = (struct linuxDirent64 *) (buf + pos);
+            visitEntry(self, t, dirFD, d->d_name, d->d_type);
+            pos += d->d_reclen;
+        }
+    }
+    close(dirFD);
+#else
+    DIR *dir = fdopendir(dirFD);
+    struct dirent *d;
+    if (dir == NULL) {
+        close(dirFD);
+        return;
+    }
+    while ((d = readdir(dir)) != NULL)
+        visitEntry(self, t, dirFD, d->d_name, d->d_type);
+    closedir(dir);
+#endif
+}
+
+/**
+ * work on one queued directory
+*/
+static void runTask(struct worker *self, struct task *t) {
+    struct pattern *pat = self->walk->pat;
+    struct segment *seg = &pat->segs[t->seg];
+    int last = (t->seg == pat->numSegs - 1);
+
+    if (seg->literal) { // nothing to match, just look the name up
+        char *path = joinPath(t->path, seg->text);
+        struct stat st;
+        if (!last) {
+            push(self, path, t->seg + 1);
+        } else if (stat(path, &st) == 0 && (!pat->dirOnly || S_ISDIR(st.st_mode))) {
+            addResult(self, path);
+        } else if (!pat->dirOnly && lstat(path, &st) == 0) { // dangling symlink
+            addResult(self, path);
+        } else {
+            efree(path);
+        }
+        return;
+    }
+
+    if (seg->globstar && !last) // ** matching no directories at all
+        push(self, estrndup(t->path, strlen(t->path)), t->seg + 1);
+    readDirectory(self, t);
+}
+
+static void *workerLoop(void *arg) {
+    struct worker *self = arg;
+    struct walker *walk = self->walk;
+    struct task t;
+
+    for (;;) {
+        if (take(self, &t)) {
+            runTask(self, &t);
+            efree(t.path);
+            if (__atomic_sub_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+                pthread_mutex_lock(&walk->idleLock);
+                pthread_cond_broadcast(&walk->idleCond);
+                pthread_mutex_unlock(&walk->idleLock);
+            }
+            continue;
+        }
+        if (__atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST) == 0)
+            return NULL;
+
+        // nothing to steal right now, sleep until somebody pushes or a short while passes
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += IDLE_WAIT_NS;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&walk->idleLock);
+        __atomic_add_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST) > 0)
+            pthread_cond_timedwait(&walk->idleCond, &walk->idleLock, &until);
+        __atomic_sub_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&walk->idleLock);
+    }
+}
+
+static int compareStrings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * how many threads to walk with, one unless the pattern can spread over several directories
+*/
+static int walkerCount(struct pattern *pat) {
+    int i, wild = 0, n;
+    char *env;
+
+    for (i = 0; i < pat->numSegs; i++) {
+        if (pat->segs[i].globstar)
+            wild += 2;
+        else if (!pat->segs[i].literal && i < pat->numSegs - 1)
+            wild++;
+    }
+    if (wild == 0)
+        return 1;
+    if ((env = getenv("SMSH_GLOB_THREADS")) != NULL && atoi(env) > 0)
+        n = atoi(env);
+    else
+        n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    return n > MAX_WALKERS ? MAX_WALKERS : n;
+}
+
+/**
+ * expand a glob pattern
+ * @param pattern - the pattern, see the top of this file
+ * @param count - set to the number of matches
+ * @return a sorted NULL terminated list of matching paths, free with freeGlobWalk
+*/
+char **globWalk(char *pattern, int *count) {
+    struct walker walk;
+    struct pattern *pat = compilePattern(pattern);
+    char **matches;
+    int i, total = 0;
+
+    *count = 0;
+    if (pat->numSegs == 0) {
+        freePattern(pat);
+        return NULL;
+    }
+
+    walk.pat = pat;
+    walk.numWorkers = walkerCount(pat);
+    walk.workers = ecalloc(walk.numWorkers, sizeof(struct worker));
+    walk.pending = 0;
+    walk.sleepers = 0;
+    pthread_mutex_init(&walk.idleLock, NULL);
+    pthread_cond_init(&walk.idleCond, NULL);
+    for (i = 0; i < walk.numWorkers; i++) {
+        walk.workers[i].walk = &walk;
+        pthread_mutex_init(&walk.workers[i].dq.lock, NULL);
+    }
+
+    push(&walk.workers[0], estrndup(pat->root, strlen(pat->root)), 0);
+    // the calling thread is worker 0, the rest steal from it
+    for (i = 1; i < walk.numWorkers; i++) {
+        if (pthread_create(&walk.workers[i].thread, NULL, workerLoop, &walk.workers[i]) != 0) {
+            walk.numWorkers = i; // carry on with the threads we did get
+            break;
+        }
+    }
+    workerLoop(&walk.workers[0]);
+    for (i = 1; i < walk.numWorkers; i++)
+        pthread_join(walk.workers[i].thread, NULL);
+
+    for (i = 0; i < walk.numWorkers; i++)
+        total += walk.workers[i].numResults;
+    matches = emalloc(sizeof(char *) * (total + 1));
+    for (i = 0, total = 0; i < walk.numWorkers; i++) {
+        struct worker *w = &walk.workers[i];
+        memcpy(matches + total, w->results, sizeof(char *) * w->numResults);
+        total += w->numResults;
+        efree(w->results);
+        efree(w->dq.tasks);
+        pthread_mutex_destroy(&w->dq.lock);
+    }
+    matches[total] = NULL;
+    for (i = 0; pat->dirOnly && i < total; i++) {
+        matches[i] = erealloc(matches[i], strlen(matches[i]) + 2);
+        strcat(matches[i], "/");
+    }
+    qsort(matches, total, sizeof(char *), compareStrings);
+
+    pthread_mutex_destroy(&walk.idleLock);
+    pthread_cond_destroy(&walk.idleCond);
+    efree(walk.workers);
+    freePattern(pat);
+    *count = total;
+    return matches;
+}
+
+void freeGlobWalk(char **matches) {
+    if (matches != NULL)
+        freelist(matches);
+}
@@ -0,0 +1,232 @@
+/* limits.c - resource limits for the commands smsh runs
+ *
+ *    int builtinUlimit(char **argv)             - ulimit: limits for every command from now on
+ *    int builtinLimit(char **argv, in, out)     - limit: limits for a single command
+ *    void applyLimits()                         - called in the child before execvp
+ *    void reportLimits(int status, rusage *ru)  - called once the child is reaped
+ *
+ *  limits are never set on the shell itself, only on the children it forks,
+ *  so a limit on processes or cpu time can't lock up the shell.
+ *
+ *      ulimit [-a] [-t secs] [-v kbytes] [-n files] [-u procs]
+ *      limit [-t secs] [-v kbytes] [-n files] [-u procs] cmd [args ...]
+ *  a value of "unlimited" removes the limit, commands get whatever the shell has.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <signal.h>
+#include    <sys/time.h>
+#include    <sys/resource.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+struct limitSpec {
+    int resource;
+    char flag;
+    char *name;
+    char *unit;
+    rlim_t scale; // bytes per unit
+};
+
+static struct limitSpec specs[] = {
+        {RLIMIT_CPU,    't', "cpu time",      "seconds",   1},
+        {RLIMIT_AS,     'v', "address space", "kbytes",    1024},
+        {RLIMIT_NOFILE, 'n', "open files",    "files",     1},
+        {RLIMIT_NPROC,  'u', "processes",     "processes", 1},
+};
+#define NUM_LIMITS (sizeof(specs) / sizeof(specs[0]))
+
+static rlim_t shellLimits[NUM_LIMITS]; // set by ulimit
+static int shellSet[NUM_LIMITS];
+static rlim_t cmdLimits[NUM_LIMITS];   // set by limit for one command
+static int cmdSet[NUM_LIMITS];
+static int reportUsage = NO;           // print what the command used, set by limit
+
+static int findLimit(char flag) {
+    int i;
+    for (i = 0; i < NUM_LIMITS; i++) {
+        if (specs[i].flag == flag)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * limit in force for the command being run
+ * @return YES with it in value, NO if nothing limits it
+*/
+static int effectiveLimit(int i, rlim_t *value) {
+    if (cmdSet[i]) {
+        *value = cmdLimits[i];
+        return YES;
+    }
+    if (shellSet[i]) {
+        *value = shellLimits[i];
+        return YES;
+    }
+    return NO;
+}
+
+/**
+ * parse -X value options into limits/set
+ * @return index of the first argument that isn't an option, -1 on error
+*/
+static int parseLimits(char **argv, rlim_t *limits, int *set, int *showAll) {
+    int i;
+    for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        int which;
+        char *end;
+
+        if (showAll != NULL && strcmp(argv[i], "-a") == 0) {
+            *showAll = YES;
+            continue;
+        }
+        if (strlen(argv[i]) != 2 || (which = findLimit(argv[i][1])) == -1) {
+            fprintf(stderr, "%s: unknown option %s\n", argv[0], argv[i]);
+            return -1;
+        }
+        if (argv[i + 1] == NULL) {
+            fprintf(stderr, "%s: %s needs a value\n", argv[0], argv[i]);
+            return -1;
+        }
+        i++;
+        if (strcmp(argv[i], "unlimited") == 0) {
+            limits[which] = RLIM_INFINITY;
+        } else {
+            unsigned long long value = strtoull(argv[i], &end, 10);
+            if (*end != '\0' || argv[i][0] == '-') {
+                fprintf(stderr, "%s: bad %s limit: %s\n", argv[0], specs[which].name, argv[i]);
+                return -1;
+            }
+            limits[which] = (rlim_t) value * specs[which].scale;
+        }
+        set[which] = YES;
+    }
+    return i;
+}
+
+/**
+ * ulimit builtin, sets limits for every command run from now on
+ * @return status as returned via wait
+*/
+int builtinUlimit(char **argv) {
+    rlim_t limits[NUM_LIMITS];
+    int set[NUM_LIMITS] = {NO};
+    int showAll = NO;
+    int i, end;
+
+    if ((end = parseLimits(argv, limits, set, &showAll)) == -1 || argv[end] != NULL) {
+        if (end != -1)
+            fprintf(stderr, "usage: ulimit [-a] [-t secs] [-v kbytes] [-n files] [-u procs]\n");
+        return EXIT_STATUS(2);
+    }
+    for (i = 0; i < NUM_LIMITS; i++) {
+        if (set[i]) {
+            shellLimits[i] = limits[i];
+            shellSet[i] = YES;
+        }
+    }
+    if (end > 1 && !showAll)
+        return 0;
+
+    for (i = 0; i < NUM_LIMITS; i++) {
+        struct rlimit rl;
+        rlim_t value;
+        if (!effectiveLimit(i, &value)) { // nothing set, show what commands inherit
+            getrlimit(specs[i].resource, &rl);
+            value = rl.rlim_cur;
+        }
+        char unit[32];
+        snprintf(unit, sizeof(unit), "(%s, -%c)", specs[i].unit, specs[i].flag);
+        printf("%-14s %-16s ", specs[i].name, unit);
+        if (value == RLIM_INFINITY)
+            printf("unlimited\n");
+        else
+            printf("%llu\n", (unsigned long long) (value / specs[i].scale));
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * limit builtin, runs one command with its own limits and reports what it used
+ * @return status as returned via wait
+*/
+int builtinLimit(char **argv, char *inFile, char *outFile) {
+    int end, result;
+
+    if ((end = parseLimits(argv, cmdLimits, cmdSet, NULL)) == -1 || argv[end] == NULL) {
+        if (end != -1)
+            fprintf(stderr, "usage: limit [-t secs] [-v kbytes] [-n files] [-u procs] cmd [args ...]\n");
+        memset(cmdSet, 0, sizeof(cmdSet));
+        return EXIT_STATUS(2);
+    }
+    reportUsage = YES;
+    result = execute(argv + end, inFile, outFile);
+    reportUsage = NO;
+    memset(cmdSet, 0, sizeof(cmdSet));
+    return result;
+}
+
+/**
+ * apply the limits in force, called in the child between fork and execvp
+*/
+void applyLimits() {
+    int i;
+    for (i = 0; i < NUM_LIMITS; i++) {
+        struct rlimit rl;
+        rlim_t value;
+        if (!effectiveLimit(i, &value) || value == RLIM_INFINITY)
+            continue; // unlimited just means we don't lower what the shell has
+        rl.rlim_cur = value;
+        rl.rlim_max = value;
+        // leave a second between SIGXCPU and SIGKILL so we can tell which limit it was
+        if (specs[i].resource == RLIMIT_CPU)
+            rl.rlim_max = value + 1;
+        if (setrlimit(specs[i].resource, &rl) == -1)
+            perror(specs[i].name);
+    }
+}
+
+/**
+ * say when a reaped command was stopped by a limit, and for a command
+ * run by limit what it used. a limit shows in how the command died: the
+ * cpu limit with SIGXCPU (or SIGKILL at the hard limit), a file size limit
+ * it inherited with SIGXFSZ, and running out of address space usually as
+ * a crash or abort when an allocation fails. open files and processes
+ * just make a call fail, the command reports that itself
+ * @param status - status from wait
+ * @param ru - its resource usage from wait4
+*/
+void reportLimits(int status, struct rusage *ru) {
+    int i, sig;
+    double cpu = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+                 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+
+    if (!WIFSIGNALED(status))
+        sig = 0;
+    else if ((sig = WTERMSIG(status)) == SIGXFSZ)
+        fprintf(stderr, "limit: file size limit exceeded\n");
+
+    for (i = 0; sig != 0 && i < NUM_LIMITS; i++) {
+        rlim_t value;
+        if (!effectiveLimit(i, &value) || value == RLIM_INFINITY)
+            continue;
+        if (specs[i].resource == RLIMIT_CPU && (sig == SIGXCPU || (sig == SIGKILL && cpu >= value))) {
+            fprintf(stderr, "limit: cpu time limit of %llu seconds exceeded\n",
+                    (unsigned long long) value);
+        } else if (specs[i].resource == RLIMIT_AS && (sig == SIGSEGV || sig == SIGBUS || sig == SIGABRT)) {
+            fprintf(stderr, "limit: %s with an address space limit of %llu kbytes\n",
+                    strsignal(sig), (unsigned long long) (value / specs[i].scale));
+        }
+    }
+
+    if (reportUsage) {
+        fprintf(stderr, "usage: %ld.%02lds user %ld.%02lds sys, max rss %ld kbytes, %ld/%ld context switches\n",
+                (long) ru->ru_utime.tv_sec, (long) ru->ru_utime.tv_usec / 10000,
+                (long) ru->ru_stime.tv_sec, (long) ru->ru_stime.tv_usec / 10000,
+                ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+    }
+}
@@ -0,0 +1,170 @@
+/* loadable.c - builtins loaded from shared objects for smsh4
+ *
+ *    int builtinEnable(char **argv)                            - the enable builtin
+ *    int runLoadable(char **argv, in, out, int *result)        - run argv if it is a loaded builtin
+ *
+ *      enable -f lib.so NAME [NAME ...]   load builtins from lib.so, see smsh_builtin.h
+ *      enable -n NAME [NAME ...]          drop them again
+ *      enable                             list what is loaded
+ *
+ *  a loaded builtin runs inside the shell, so like the other builtins it is
+ *  only used for simple commands, a pipeline stage still runs the program.
+ *  a builtin that crashes takes the shell with it, only load code you trust.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <string.h>
+#include    <fcntl.h>
+#include    <dlfcn.h>
+#include    "smsh.h"
+#include    "smsh_builtin.h"
+
+#define MAX_LOADABLE 64
+#define SYMBOL_PREFIX "smsh_builtin_"
+
+struct loadable {
+    struct smsh_builtin *builtin; // NULL for a free slot
+    void *handle;                 // one dlopen reference per builtin
+    char *lib;
+};
+
+static struct loadable loaded[MAX_LOADABLE];
+
+static struct loadable *findLoadable(char *name) {
+    int i;
+    for (i = 0; i < MAX_LOADABLE; i++) {
+        if (loaded[i].builtin != NULL && strcmp(loaded[i].builtin->name, name) == 0)
+            return &loaded[i];
+    }
+    return NULL;
+}
+
+/**
+ * load builtin name from lib
+ * @return YES if it was loaded
+*/
+static int enableBuiltin(char *lib, char *name) {
+    struct loadable *lp = NULL;
+    struct smsh_builtin *b;
+    void *handle;
+    int i;
+
+    if (findLoadable(name) != NULL) {
+        fprintf(stderr, "enable: %s is already loaded\n", name);
+        return NO;
+    }
+    for (i = 0; i < MAX_LOADABLE && lp == NULL; i++) {
+        if (loaded[i].builtin == NULL)
+            lp = &loaded[i];
+    }
+    if (lp == NULL) {
+        fprintf(stderr, "enable: too many builtins, at most %d\n", MAX_LOADABLE);
+        return NO;
+    }
+    if ((handle = dlopen(lib, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        fprintf(stderr, "enable: %s\n", dlerror());
+        return NO;
+    }
+
+    char symbol[sizeof(SYMBOL_PREFIX) + strlen(name)];
+    snprintf(symbol, sizeof(symbol), "%s%s", SYMBOL_PREFIX, name);
+    if ((b = dlsym(handle, symbol)) == NULL) {
+        fprintf(stderr, "enable: %s has no builtin %s\n", lib, name);
+    } else if (b->abi != SMSH_BUILTIN_ABI) {
+        fprintf(stderr, "enable: %s was built for builtin ABI %d, the shell has %d\n",
+                name, b->abi, SMSH_BUILTIN_ABI);
+    } else if (b->fn == NULL || b->name == NULL || strcmp(b->name, name) != 0) {
+        fprintf(stderr, "enable: %s in %s is malformed\n", symbol, lib);
+    } else {
+        lp->builtin = b;
+        lp->handle = handle;
+        lp->lib = estrndup(lib, strlen(lib));
+        return YES;
+    }
+    dlclose(handle);
+    return NO;
+}
+
+/**
+ * enable builtin, see the top of the file
+ * @return status as returned via wait
+*/
+int builtinEnable(char **argv) {
+    int i, failed = NO;
+
+    if (argv[1] == NULL) {
+        for (i = 0; i < MAX_LOADABLE; i++) {
+            if (loaded[i].builtin == NULL)
+                continue;
+            printf("%-12s %-24s %s\n", loaded[i].builtin->name, loaded[i].lib,
+                   loaded[i].builtin->usage != NULL ? loaded[i].builtin->usage : "");
+        }
+        fflush(stdout);
+        return 0;
+    }
+    if (strcmp(argv[1], "-f") == 0 && argv[2] != NULL && argv[3] != NULL) {
+        for (i = 3; argv[i] != NULL; i++) {
+            if (!enableBuiltin(argv[2], argv[i]))
+                failed = YES;
+        }
+    } else if (strcmp(argv[1], "-n") == 0 && argv[2] != NULL) {
+        for (i = 2; argv[i] != NULL; i++) {
+            struct loadable *lp = findLoadable(argv[i]);
+            if (lp == NULL) {
+                fprintf(stderr, "enable: %s is not loaded\n", argv[i]);
+                failed = YES;
+                continue;
+            }
+            lp->builtin = NULL;
+            dlclose(lp->handle);
+            efree(lp->lib);
+        }
+    } else {
+        fprintf(stderr, "usage: enable [-f lib.so NAME ... | -n NAME ...]\n");
+        return EXIT_STATUS(2);
+    }
+    return failed ? EXIT_STATUS(1) : 0;
+}
+
+/**
+ * run a loaded builtin in the shell, with its redirects opened as execute would
+ * @param result - set to its status, as execute would return it
+ * @return YES if argv was a loaded builtin
+*/
+int runLoadable(char **argv, char *inFile, char *outFile, int *result) {
+    struct loadable *lp;
+    int inFD = STDIN_FILENO, outFD = STDOUT_FILENO;
+    int argc, code;
+
+    if ((lp = findLoadable(argv[0])) == NULL)
+        return NO;
+
+    if (inFile != NULL && (inFD = open(inFile, O_RDONLY)) == -1) {
+        perror(inFile);
+        *result = EXIT_STATUS(1);
+        return YES;
+    }
+    if (outFile != NULL) {
+        if ((outFD = open(outFile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) { // same as execute
+            perror(outFile);
+            if (inFD != STDIN_FILENO)
+                close(inFD);
+            *result = EXIT_STATUS(1);
+            return YES;
+        }
+    }
+
+    for (argc = 0; argv[argc] != NULL; argc++)
+        ;
+    fflush(stdout); // anything the shell printed comes first
+    code = lp->builtin->fn(argc, argv, inFD, outFD);
+
+    if (inFD != STDIN_FILENO)
+        close(inFD);
+    if (outFD != STDOUT_FILENO)
+        close(outFD);
+    *result = EXIT_STATUS(code & 0xff);
+    return YES;
+}
@@ -0,0 +1,185 @@
+/* memstats.c - counted memory allocation for smsh
+ *
+ *    void *emalloc(size_t n)                  - malloc, exits if out of memory
+ *    void *ecalloc(size_t n, size_t size)     - calloc, ditto
+ *    void *erealloc(void *p, size_t n)        - realloc, ditto
+ *    char *estrndup(const char *s, size_t n)  - strndup, ditto
+ *    void efree(void *p)                      - free for all of the above
+ *    void memstatsLine()                      - a new command line is starting
+ *    int builtinMemstats(char **argv)         - the memstats builtin
+ *
+ *  every allocation the shell makes goes through these so we can keep count
+ *  of the live bytes, the peak, and how much each command line allocated.
+ *  sizes are what the allocator really handed out (malloc_usable_size), so
+ *  nothing has to be stored alongside the blocks. efree must only be given
+ *  memory from these, it subtracts a size that was never added for anything
+ *  else (strdup, getline, ...) and the counters drift, use free for that.
+ *  memstats also shows the process's resident size and open fds, which
+ *  catch what the counters can't: leaks past these wrappers and fd leaks.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <dirent.h>
+#include    <sys/resource.h>
+#ifdef __APPLE__
+#include    <malloc/malloc.h>
+#define usableSize(p) malloc_size(p)
+#else
+#include    <malloc.h>
+#define usableSize(p) malloc_usable_size(p)
+#endif
+#include    "smsh.h"
+
+// updated from the glob walker threads too, so only touched atomically
+static long long liveBytes, peakBytes;
+static long long numAllocs, numReallocs, numFrees;
+
+// per command line, only touched by the shell's own thread
+static long long lines, lineAllocs, lineLive;
+static long long lastLineAllocs, lastLineLive, maxLineAllocs;
+
+static void countAlloc(void *p) {
+    long long live = __atomic_add_fetch(&liveBytes, (long long) usableSize(p), __ATOMIC_RELAXED);
+    long long peak = __atomic_load_n(&peakBytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&peakBytes, &peak, live, YES,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void countFree(void *p) {
+    __atomic_sub_fetch(&liveBytes, (long long) usableSize(p), __ATOMIC_RELAXED);
+}
+
+void * emalloc(size_t n)
+{
+	void *rv ;
+	if ( (rv = malloc(n)) == NULL )
+		fatal("out of memory","",1);
+	__atomic_add_fetch(&numAllocs, 1, __ATOMIC_RELAXED);
+	countAlloc(rv);
+	return rv;
+}
+
+void * ecalloc(size_t n, size_t size)
+{
+	void *rv ;
+	if ( (rv = calloc(n, size)) == NULL )
+		fatal("out of memory","",1);
+	__atomic_add_fetch(&numAllocs, 1, __ATOMIC_RELAXED);
+	countAlloc(rv);
+	return rv;
+}
+
+void * erealloc(void *p, size_t n)
+{
+	void *rv;
+	if ( p == NULL )
+		return emalloc(n);
+	countFree(p);
+	if ( (rv = realloc(p,n)) == NULL )
+		fatal("realloc() failed","",1);
+	__atomic_add_fetch(&numReallocs, 1, __ATOMIC_RELAXED);
+	countAlloc(rv);
+	return rv;
+}
+
+char * estrndup(const char *s, size_t n)
+{
+	char *rv;
+	if ( (rv = strndup(s, n)) == NULL )
+		fatal("out of memory","",1);
+	__atomic_add_fetch(&numAllocs, 1, __ATOMIC_RELAXED);
+	countAlloc(rv);
+	return rv;
+}
+
+void efree(void *p)
+{
+	if ( p == NULL )
+		return;
+	__atomic_add_fetch(&numFrees, 1, __ATOMIC_RELAXED);
+	countFree(p);
+	free(p);
+}
+
+/**
+ * close off the stats of the previous command line and start counting a new one
+*/
+void memstatsLine() {
+    long long allocs = __atomic_load_n(&numAllocs, __ATOMIC_RELAXED);
+    long long live = __atomic_load_n(&liveBytes, __ATOMIC_RELAXED);
+
+    if (lines > 0) {
+        lastLineAllocs = allocs - lineAllocs;
+        lastLineLive = live - lineLive;
+        if (lastLineAllocs > maxLineAllocs)
+            maxLineAllocs = lastLineAllocs;
+    }
+    lines++;
+    lineAllocs = allocs;
+    lineLive = live;
+}
+
+/**
+ * resident size of the shell in kbytes, the peak where there is no /proc
+*/
+static long residentKB() {
+    char line[256];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "VmRSS: %ld", &kb) == 1)
+                break;
+        }
+        fclose(fp);
+    }
+    if (kb == -1) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+        kb = ru.ru_maxrss / 1024; // bytes there
+#else
+        kb = ru.ru_maxrss;
+#endif
+    }
+    return kb;
+}
+
+/**
+ * number of fds the shell has open, -1 if they can't be listed
+*/
+static int openFDs() {
+    DIR *dir = opendir("/dev/fd");
+    struct dirent *de;
+    int n = 0;
+    if (dir == NULL)
+        return -1;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.')
+            n++;
+    }
+    closedir(dir);
+    return n - 1; // not the one opendir has open
+}
+
+/**
+ * memstats builtin, prints the allocation counters
+ * @return status as returned via wait
+*/
+int builtinMemstats(char **argv) {
+    printf("live bytes        %lld\n", __atomic_load_n(&liveBytes, __ATOMIC_RELAXED));
+    printf("peak bytes        %lld\n", __atomic_load_n(&peakBytes, __ATOMIC_RELAXED));
+    printf("allocations       %lld\n", __atomic_load_n(&numAllocs, __ATOMIC_RELAXED));
+    printf("reallocations     %lld\n", __atomic_load_n(&numReallocs, __ATOMIC_RELAXED));
+    printf("frees             %lld\n", __atomic_load_n(&numFrees, __ATOMIC_RELAXED));
+    printf("lines             %lld\n", lines);
+    printf("last line         %lld allocations, %+lld live bytes\n", lastLineAllocs, lastLineLive);
+    printf("busiest line      %lld allocations\n", maxLineAllocs);
+    printf("resident kbytes   %ld\n", residentKB());
+    printf("open fds          %d\n", openFDs());
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* meter.c - pipeline throughput metering for smsh4
+ *
+ *    int meterPrefix(char *cmdline, int *mode, int *size) - strip a leading "meter [-l] [-s N]"
+ *    int executePipeMetered(...)                          - run a pipeline through a splice relay
+ *
+ *  instead of connecting the stages directly, every stage writes into its own
+ *  pipe and the shell splices the data across to the next stage. that lets us
+ *  count the bytes each stage produced and how long each hop spent
+ *      waiting     - nothing to move, the stage writing into it is slow
+ *      backpressure - data ready but the next stage isn't reading it
+ *  the data is only moved between pipe buffers, it never enters user space.
+ */
+
+#define _GNU_SOURCE
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <unistd.h>
+#include    <signal.h>
+#include    <errno.h>
+#include    <fcntl.h>
+#include    <time.h>
+#include    <poll.h>
+#include    <sys/ioctl.h>
+#include    <sys/resource.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+#define HOP_WAIT_IN  0 // waiting for the writing stage to produce
+#define HOP_WAIT_OUT 1 // waiting for the reading stage to make room
+#define HOP_DONE     2
+
+#define SPLICE_CHUNK (1 << 20)
+#define LIVE_INTERVAL_MS 1000
+
+int meterPipes = NO; // --meter / --meter-live, METER_END or METER_LIVE for every pipeline
+
+struct hop {
+    int from, to;         // read end of stage i's output, write end of stage i+1's input
+    int state;
+    long long bytes;
+    double waiting;       // seconds spent in HOP_WAIT_IN
+    double backpressure;  // seconds spent in HOP_WAIT_OUT
+    double finished;      // seconds from start until EOF
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * strip a leading meter prefix off a command line, in place
+ *      meter [-l] [-s SIZE] cmd | cmd ...
+ * @param mode - set to METER_END, or METER_LIVE with -l
+ * @param size - set to the pipe capacity asked for with -s
+ * @return YES if the line had the prefix
+*/
+int meterPrefix(char *cmdline, int *mode, int *size) {
+    char *cp = cmdline;
+    while (*cp == ' ' || *cp == '\t')
+        cp++;
+    if (strncmp(cp, "meter", 5) != 0 || (cp[5] != ' ' && cp[5] != '\t'))
+        return NO;
+    cp += 5;
+    *mode = METER_END;
+    for (;;) {
+        while (*cp == ' ' || *cp == '\t')
+            cp++;
+        if (strncmp(cp, "-l", 2) == 0 && (cp[2] == ' ' || cp[2] == '\t')) {
+            *mode = METER_LIVE;
+            cp += 2;
+        } else if (strncmp(cp, "-s", 2) == 0 && (cp[2] == ' ' || cp[2] == '\t')) {
+            *size = (int) strtol(cp + 3, &cp, 10);
+        } else {
+            break;
+        }
+    }
+    memmove(cmdline, cp, strlen(cp) + 1);
+    return YES;
+}
+
+/**
+ * move whatever can be moved across a hop without blocking, then work out what it waits on
+*/
+static void pump(struct hop *h, double start) {
+    ssize_t n;
+    int avail = 0;
+
+    for (;;) {
+        n = splice(h->from, NULL, h->to, NULL, SPLICE_CHUNK, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) {
+            h->bytes += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN) {
+            ioctl(h->from, FIONREAD, &avail);
+            h->state = avail > 0 ? HOP_WAIT_OUT : HOP_WAIT_IN;
+            return;
+        }
+        // EOF from the writer, or the reader went away (EPIPE)
+        if (n == -1 && errno != EPIPE)
+            perror("splice");
+        close(h->from);
+        close(h->to);
+        h->state = HOP_DONE;
+        h->finished = now() - start;
+        return;
+    }
+}
+
+static void printLive(struct hop *hops, int numHops, double elapsed) {
+    int i;
+    fprintf(stderr, "meter: [%.1fs]", elapsed);
+    for (i = 0; i < numHops; i++) {
+        fprintf(stderr, " %d->%d %.1fMB", i, i + 1, hops[i].bytes / 1e6);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void printReport(char ***pipeCmds, struct hop *hops, int numHops, double elapsed) {
+    int i;
+    fprintf(stderr, "meter: %-3s %-20s %14s %10s %10s %13s\n",
+            "#", "stage", "bytes out", "MB/s", "waiting", "backpressure");
+    for (i = 0; i <= numHops; i++) {
+        fprintf(stderr, "meter: %-3d %-20.20s ", i, pipeCmds[i][0]);
+        if (i == numHops) {
+            fprintf(stderr, "%14s %10s %10s %13s\n", "-", "-", "-", "-");
+            continue;
+        }
+        double active = hops[i].finished > 0 ? hops[i].finished : elapsed;
+        fprintf(stderr, "%14lld %10.1f %9.2fs %12.2fs\n", hops[i].bytes,
+                active > 0 ? hops[i].bytes / active / 1e6 : 0.0,
+                hops[i].waiting, hops[i].backpressure);
+    }
+    fprintf(stderr, "meter: total %.2fs\n", elapsed);
+}
+
+/**
+ * executePipe with the shell relaying every hop, see the top of this file
+ * @param mode - METER_END reports when the pipeline is done, METER_LIVE also every second
+ * @param size - pipe capacity for the relay pipes, 0 for the global --pipe-size
+ * @return status of the last stage as returned via wait
+*/
+int executePipeMetered(char ***pipeCmds, int numCommands, char *inFiles[], char *outFiles[],
+                       const char redirPos[], int mode, int size) {
+    int numHops = numCommands - 1;
+    struct hop hops[numHops];
+    pid_t pids[numCommands];
+    int outPipe[2], inPipe[2], prevIn = -1;
+    int child_info = -1, status;
+    int i;
+
+    if (size <= 0)
+        size = pipeSize;
+
+    for (i = 0; i < numCommands; i++) {
+        int outFD = -1;
+        char redir = redirPos != NULL ? redirPos[i] : '\0';
+        if (i < numHops) {
+            if (pipe2(outPipe, O_CLOEXEC) == -1 || pipe2(inPipe, O_CLOEXEC) == -1) {
+                perror("Issue with pipe");
+                exit(1);
+            }
+            setPipeSize(outPipe[1], size);
+            setPipeSize(inPipe[1], size);
+            outFD = outPipe[1];
+            hops[i].from = outPipe[0];
+            hops[i].to = inPipe[1];
+            hops[i].state = HOP_WAIT_IN;
+            hops[i].bytes = 0;
+            hops[i].waiting = hops[i].backpressure = hops[i].finished = 0;
+        }
+        // all relay pipes are close-on-exec, the stage only keeps what it was given
+        if ((pids[i] = spawnChild(pipeCmds[i], prevIn, outFD, redir == '<' ? inFiles[i] : NULL,
+                                  redir == '>' ? outFiles[i] : NULL, i, NO)) == -1)
+            exit(1);
+        if (prevIn != -1)
+            close(prevIn);
+        if (i < numHops) {
+            close(outFD);
+            prevIn = inPipe[0];
+        }
+    }
+
+    void (*oldPipe)(int) = signal(SIGPIPE, SIG_IGN);
+    double start = now(), lastLive = start;
+    struct pollfd fds[numHops];
+    int who[numHops];
+    int live = numHops;
+
+    while (live > 0) {
+        int nfds = 0;
+        for (i = 0; i < numHops; i++) {
+            if (hops[i].state == HOP_DONE)
+                continue;
+            fds[nfds].fd = hops[i].state == HOP_WAIT_IN ? hops[i].from : hops[i].to;
+            fds[nfds].events = hops[i].state == HOP_WAIT_IN ? POLLIN : POLLOUT;
+            who[nfds++] = i;
+        }
+
+        double before = now();
+        int ready = poll(fds, nfds, mode == METER_LIVE ? LIVE_INTERVAL_MS : -1);
+        double after = now();
+        if (ready == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        // every hop still open spent the poll waiting on something
+        for (i = 0; i < nfds; i++) {
+            struct hop *h = &hops[who[i]];
+            if (h->state == HOP_WAIT_IN)
+                h->waiting += after - before;
+            else
+                h->backpressure += after - before;
+        }
+        for (i = 0; ready > 0 && i < nfds; i++) {
+            if (fds[i].revents != 0) {
+                pump(&hops[who[i]], start);
+                if (hops[who[i]].state == HOP_DONE)
+                    live--;
+            }
+        }
+
+        if (mode == METER_LIVE && after - lastLive >= LIVE_INTERVAL_MS / 1000.0) {
+            printLive(hops, numHops, after - start);
+            lastLive = after;
+        }
+    }
+    signal(SIGPIPE, oldPipe);
+
+    for (i = 0; i < numCommands; i++) {
+        struct rusage ru;
+        if (wait4(pids[i], &status, 0, &ru) == -1) {
+            perror("wait issue");
+            continue;
+        }
+        reportLimits(status, &ru);
+        if (i == numCommands - 1)
+            child_info = status;
+    }
+    printReport(pipeCmds, hops, numHops, now() - start);
+    return child_info;
+}
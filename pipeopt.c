@@ -0,0 +1,128 @@
+/* pipeopt.c - pipeline optimizer pass for smsh4
+ *
+ *    int optimizePipe(...)  - rewrite a parsed pipeline before it is executed
+ *    void printPipePlan(...) - print a parsed pipeline to stderr
+ *
+ *  rewrites done:
+ *      cat FILE | cmd ...      ->  cmd < FILE | ...
+ *      ... | cat | ...         ->  ... | ...      (cat/tee with no args just copy)
+ *
+ *  the last stage is never dropped, what the stage before it writes to
+ *  would change from a pipe to the shell's stdout (ls | cat on a terminal).
+ *
+ *  every stage dropped saves a fork and a copy of the whole stream through a pipe.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <unistd.h>
+#include    <sys/stat.h>
+#include    "smsh.h"
+
+int pipeOptimize = YES; // cleared by --no-pipeopt
+int showPlan = NO;      // set by --show-plan
+
+/**
+ * is this stage a plain copy of stdin to stdout (cat, cat -, tee)
+*/
+static int isPassthrough(char **argv) {
+    if (argv[0] == NULL)
+        return NO;
+    if (strcmp(argv[0], "cat") == 0) {
+        return argv[1] == NULL || (strcmp(argv[1], "-") == 0 && argv[2] == NULL);
+    }
+    return strcmp(argv[0], "tee") == 0 && argv[1] == NULL;
+}
+
+/**
+ * can FILE be handed to the next stage as an input redirect instead of going through cat
+ * only readable regular files, anything else keeps cat's own error reporting
+*/
+static int canRedirect(char *file) {
+    struct stat st;
+    if (file[0] == '-' || stat(file, &st) == -1 || !S_ISREG(st.st_mode))
+        return NO;
+    return access(file, R_OK) == 0;
+}
+
+/**
+ * remove stage i from the pipeline, shifting the later stages down
+*/
+static void dropStage(char ***pipes, int numCommands, char **inFiles, char **outFiles, char *redirPos, int i) {
+    freelist(pipes[i]);
+    for (; i < numCommands - 1; i++) {
+        pipes[i] = pipes[i + 1];
+        inFiles[i] = inFiles[i + 1];
+        outFiles[i] = outFiles[i + 1];
+        redirPos[i] = redirPos[i + 1];
+    }
+    pipes[i] = NULL;
+    inFiles[i] = NULL;
+    outFiles[i] = NULL;
+    redirPos[i] = '\0';
+}
+
+/**
+ * optimize a parsed pipeline in place
+ * @param pipes - the stages as returned by splitlinePipe, NULL terminated
+ * @param numCommands - number of stages
+ * @param inFiles, outFiles, redirPos - per stage redirection as passed to executePipe
+ * @return the number of stages left, 1 means run it with execute instead
+*/
+int optimizePipe(char ***pipes, int numCommands, char **inFiles, char **outFiles, char *redirPos) {
+    int i;
+
+    if (!pipeOptimize)
+        return numCommands;
+    // an empty stage (ls | | wc) is left for executePipe to run as it always has
+    for (i = 0; i < numCommands; i++) {
+        if (pipes[i][0] == NULL)
+            return numCommands;
+    }
+
+    // stages that only copy their input to their output, short of the last one
+    for (i = 0; i < numCommands - 1;) {
+        if (redirPos[i] == '\0' && isPassthrough(pipes[i])) {
+            dropStage(pipes, numCommands--, inFiles, outFiles, redirPos, i);
+        } else {
+            i++;
+        }
+    }
+
+    // leading cat FILE / cat < FILE becomes an input redirect on the next stage
+    if (numCommands > 1 && redirPos[1] == '\0' && strcmp(pipes[0][0], "cat") == 0) {
+        if (redirPos[0] == '\0' && pipes[0][1] != NULL && pipes[0][2] == NULL
+            && canRedirect(pipes[0][1])) {
+            inFiles[0] = pipes[0][1];
+            redirPos[0] = '<';
+            pipes[0][1] = NULL;
+        }
+        if (redirPos[0] == '<' && isPassthrough(pipes[0])) {
+            inFiles[1] = inFiles[0];
+            redirPos[1] = '<';
+            inFiles[0] = NULL;
+            dropStage(pipes, numCommands--, inFiles, outFiles, redirPos, 0);
+        }
+    }
+    return numCommands;
+}
+
+/**
+ * print a parsed pipeline to stderr the way it is about to be run
+*/
+void printPipePlan(char ***pipes, int numCommands, char **inFiles, char **outFiles, const char *redirPos) {
+    int i, j;
+    fprintf(stderr, "plan:");
+    for (i = 0; i < numCommands; i++) {
+        if (i > 0)
+            fprintf(stderr, " |");
+        for (j = 0; pipes[i][j] != NULL; j++)
+            fprintf(stderr, " %s", pipes[i][j]);
+        if (redirPos[i] == '<')
+            fprintf(stderr, " < %s", inFiles[i]);
+        else if (redirPos[i] == '>')
+            fprintf(stderr, " > %s", outFiles[i]);
+    }
+    fprintf(stderr, "\n");
+}
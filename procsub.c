@@ -0,0 +1,153 @@
+/* procsub.c - process substitution for smsh4
+ *
+ *    int startProcSubst(char **cmd, struct procsubs *subs) - start the <(...) and >(...) in a command
+ *    void finishProcSubst(struct procsubs *subs)           - close them and wait for them
+ *
+ *      diff <(sort a.txt) <(sort b.txt)
+ *      tee >(wc -l) >(md5sum) < big.txt
+ *
+ *  every substitution is forked off as its own shell running the command
+ *  line inside the parentheses, with its stdout (for <) or stdin (for >) on
+ *  a pipe. the word is replaced by the /dev/fd path of the shell's end of
+ *  that pipe, which the outer command inherits and opens like a file, so
+ *  the substitutions run alongside it and nothing is written to disk.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <string.h>
+#include    <fcntl.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+/**
+ * find the ) closing the ( at open
+ * @return its position, NULL if there isn't one
+*/
+static char *closeParen(char *open) {
+    int depth = 0;
+    char *cp;
+    for (cp = open; *cp != '\0'; cp++) {
+        if (*cp == '(')
+            depth++;
+        else if (*cp == ')' && --depth == 0)
+            return cp;
+    }
+    return NULL;
+}
+
+/**
+ * fork a shell running inner with one end of a pipe as its stdin or stdout
+ * @param output - YES for >(...), it reads what the outer command writes
+ * @return the shell's end of the pipe, -1 if it couldn't be started
+*/
+static int forkSubst(char *inner, int output, struct procsubs *subs) {
+    int fds[2], i;
+    int ours, theirs;
+    pid_t pid;
+
+    if (pipe(fds) == -1) {
+        perror("Issue with pipe");
+        return -1;
+    }
+    ours = output ? fds[1] : fds[0];
+    theirs = output ? fds[0] : fds[1];
+    setPipeSize(fds[1], pipeSize);
+    fcntl(theirs, F_SETFD, FD_CLOEXEC); // only the substitution itself has this end
+
+    fflush(stdout); // or the child would write out our buffered output again
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // the outer ends go to the outer command, holding one would keep it from seeing EOF
+        for (i = 0; i < subs->n; i++)
+            close(subs->fds[i]);
+        close(ours);
+        dup2(theirs, output ? STDIN_FILENO : STDOUT_FILENO);
+        close(theirs);
+        process(inner);
+        fflush(stdout);
+        _exit(lastStatus); // not exit, its stdio cleanup would seek our shared stdin back
+    }
+    close(theirs);
+    subs->pids[subs->n] = pid;
+    subs->fds[subs->n] = ours;
+    subs->n++;
+    return ours;
+}
+
+/**
+ * start every <(...) and >(...) in a command and replace them by /dev/fd paths
+ * @param cmd - the command, replaced by a new copy if it had any substitutions
+ * @param subs - filled in, pass it to finishProcSubst once the command is done
+ * @return 0, or -1 after saying why the command can't be run
+*/
+int startProcSubst(char **cmd, struct procsubs *subs) {
+    char *line = *cmd, *cp, *out, *op, *copied = line;
+    int failed = NO;
+
+    subs->n = 0;
+    if (strstr(line, "<(") == NULL && strstr(line, ">(") == NULL)
+        return 0;
+
+    // a /dev/fd path is never more than 32 bytes longer than what it replaces
+    out = emalloc(strlen(line) + MAX_PROCSUB * 32 + 1);
+    op = out;
+    for (cp = line; *cp != '\0'; cp++) {
+        // only at the start of a word, cmd<(x) isn't one
+        if ((cp[0] != '<' && cp[0] != '>') || cp[1] != '(' || (cp != line && cp[-1] != ' ' && cp[-1] != '\t'))
+            continue;
+        char *end = closeParen(cp + 1);
+        if (end == NULL) {
+            fprintf(stderr, "Error: missing ) in %c(\n", cp[0]);
+            failed = YES;
+            break;
+        }
+        if (subs->n == MAX_PROCSUB) {
+            fprintf(stderr, "Error: too many process substitutions, at most %d\n", MAX_PROCSUB);
+            failed = YES;
+            break;
+        }
+
+        char *inner = estrndup(cp + 2, end - cp - 2);
+        int fd = forkSubst(inner, cp[0] == '>', subs);
+        efree(inner);
+        if (fd == -1) {
+            failed = YES;
+            break;
+        }
+        memcpy(op, copied, cp - copied);
+        op += cp - copied;
+        op += sprintf(op, "/dev/fd/%d", fd);
+        copied = end + 1;
+        cp = end;
+    }
+
+    if (failed) {
+        efree(out);
+        finishProcSubst(subs);
+        return -1;
+    }
+    strcpy(op, copied);
+    efree(*cmd);
+    *cmd = out;
+    return 0;
+}
+
+/**
+ * close the shell's ends of the substitutions and wait for them to finish,
+ * a >(...) only sees the end of its input once we have let go of it
+*/
+void finishProcSubst(struct procsubs *subs) {
+    int i;
+    for (i = 0; i < subs->n; i++)
+        close(subs->fds[i]);
+    for (i = 0; i < subs->n; i++)
+        waitpid(subs->pids[i], NULL, 0);
+    subs->n = 0;
+}
@@ -0,0 +1,187 @@
+/* sched.c - cpu affinity, nice level and io priority for the commands smsh runs
+ *
+ *    char **applySched(char **argv, int stage)  - called in the child before execvp
+ *    int schedWords(char **argv)                - how many words a sched prefix takes
+ *
+ *  a command, or any stage of a pipeline, can be given a prefix
+ *
+ *      sched [-c CPUS] [-n NICE] [-i CLASS[:LEVEL]] cmd [args ...]
+ *          -c  cpus it may run on, a list like 0,2,8-15
+ *          -n  nice level, from -20 (most favoured) to 19
+ *          -i  io priority, CLASS is rt, be or idle, LEVEL 0 (highest) to 7
+ *
+ *      sched -c 2 grep foo big.txt | sched -c 3 -n 5 sort
+ *
+ *  with spreadStages set (smsh4 --spread) every pipeline stage without a
+ *  -c of its own is pinned to a different cpu out of those the shell may
+ *  use, so the stages of a heavy pipeline stop sharing cores and caches.
+ *  it is all applied in the child, the shell itself is never changed.
+ *  -c, -i and --spread need linux, elsewhere -c and -i are refused and
+ *  --spread does nothing.
+ */
+
+#define _GNU_SOURCE
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <string.h>
+#include    <sys/resource.h>
+#ifdef __linux__
+#include    <sched.h>
+#include    <sys/syscall.h>
+#endif
+#include    "smsh.h"
+
+int spreadStages = NO; // pin each pipeline stage to its own cpu
+
+/**
+ * how many words at the start of argv are a sched prefix, 0 if it has none
+*/
+int schedWords(char **argv) {
+    int i;
+    if (argv[0] == NULL || strcmp(argv[0], "sched") != 0)
+        return 0;
+    for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i += 2) {
+        if (argv[i + 1] == NULL)
+            return i + 1;
+    }
+    return i;
+}
+
+#ifdef __linux__
+// from linux/ioprio.h, glibc has no wrapper for ioprio_set
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static char *ioClasses[] = {"none", "rt", "be", "idle"};
+#define NUM_IO_CLASSES (sizeof(ioClasses) / sizeof(ioClasses[0]))
+
+/**
+ * parse a cpu list like 0,2,8-15 into set
+ * @return YES if it was all understood
+*/
+static int parseCpus(char *list, cpu_set_t *set) {
+    char *cp = list, *end;
+    CPU_ZERO(set);
+    do {
+        long first = strtol(cp, &end, 10), last = first;
+        if (end == cp || first < 0)
+            return NO;
+        if (*end == '-') {
+            cp = end + 1;
+            last = strtol(cp, &end, 10);
+            if (end == cp || last < first)
+                return NO;
+        }
+        if (last >= CPU_SETSIZE)
+            return NO;
+        for (; first <= last; first++)
+            CPU_SET(first, set);
+        cp = end + 1;
+    } while (*end == ',');
+    return *end == '\0';
+}
+
+/**
+ * pin this process to the stage'th of the cpus it may run on
+*/
+static void spreadCpu(int stage) {
+    cpu_set_t allowed, one;
+    int count, cpu, seen = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || (count = CPU_COUNT(&allowed)) < 2)
+        return;
+    stage %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && seen++ == stage)
+            break;
+    }
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) == -1)
+        perror("sched: affinity");
+}
+#endif
+
+/**
+ * refuse an option this system has no way to apply
+*/
+static void schedUnsupported(char *opt) {
+    fprintf(stderr, "sched: %s is not supported on this system\n", opt);
+    _exit(2); // we are the forked child, see schedUsage
+}
+
+static void schedUsage(char *why) {
+    fprintf(stderr, "sched: %s\n", why);
+    fprintf(stderr, "usage: sched [-c CPUS] [-n NICE] [-i rt|be|idle[:LEVEL]] cmd [args ...]\n");
+    _exit(2); // we are the forked child, exit would flush the shell's stdio again
+}
+
+/**
+ * apply a sched prefix and --spread, called in the child between fork and execvp
+ * a bad prefix is reported and the child exits, a setting the system
+ * refuses (a negative nice without privilege) is reported and skipped
+ * @param stage - which stage of a pipeline this is, -1 for a single command
+ * @return the argv to exec, past the prefix
+*/
+char **applySched(char **argv, int stage) {
+    int words = schedWords(argv), i;
+#ifdef __linux__
+    int pinned = NO;
+#endif
+
+    if (words > 0 && argv[words] == NULL)
+        schedUsage("no command");
+    for (i = 1; i < words; i += 2) {
+        char *opt = argv[i], *value = argv[i + 1];
+        if (value == NULL || strlen(opt) != 2)
+            schedUsage(value == NULL ? "missing value" : "unknown option");
+
+        if (opt[1] == 'c') {
+#ifdef __linux__
+            cpu_set_t set;
+            if (!parseCpus(value, &set))
+                schedUsage("bad cpu list");
+            if (sched_setaffinity(0, sizeof(set), &set) == -1)
+                perror("sched: affinity");
+            pinned = YES;
+#else
+            schedUnsupported(opt);
+#endif
+        } else if (opt[1] == 'n') {
+            char *end;
+            long nice = strtol(value, &end, 10);
+            if (*end != '\0' || nice < -20 || nice > 19)
+                schedUsage("bad nice level");
+            if (setpriority(PRIO_PROCESS, 0, (int) nice) == -1)
+                perror("sched: nice");
+        } else if (opt[1] == 'i') {
+#ifdef __linux__
+            size_t len = strcspn(value, ":"); // argv may be a compiled script's, read only
+            int ioClass, level = 4; // what the kernel gives best effort by default
+            if (value[len] == ':')
+                level = atoi(value + len + 1);
+            for (ioClass = 1; ioClass < NUM_IO_CLASSES; ioClass++) {
+                if (strlen(ioClasses[ioClass]) == len && strncmp(value, ioClasses[ioClass], len) == 0)
+                    break;
+            }
+            if (ioClass == NUM_IO_CLASSES || level < 0 || level > 7)
+                schedUsage("bad io priority");
+            if (ioClass == NUM_IO_CLASSES - 1)
+                level = 0; // idle has no levels
+            if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (ioClass << IOPRIO_CLASS_SHIFT) | level) == -1)
+                perror("sched: io priority");
+#else
+            schedUnsupported(opt);
+#endif
+        } else {
+            schedUsage("unknown option");
+        }
+    }
+
+#ifdef __linux__
+    if (spreadStages && stage >= 0 && !pinned)
+        spreadCpu(stage);
+#endif
+    return argv + words;
+}
@@ -0,0 +1,470 @@
+/* scriptcache.c - compiled script files for smsh4
+ *
+ *    int runScript(char *path) - run a file of command lines, through its cache
+ *
+ *  the first time a script is run every line is parsed once, exactly as
+ *  process() would parse it, and the result is saved next to the script as
+ *  path.smshc. later runs map that file and build the argv of each command
+ *  straight over it, nothing is read, split or allocated per line.
+ *
+ *  the cache is keyed by the script's size and mtime, and an FNV-1a hash of
+ *  its text so that touching a script doesn't throw its cache away. layout,
+ *  all in native byte order as only this machine reads it back:
+ *
+ *      header
+ *      lines   - RAW (run through process), LIST (cmds first..first+count) or EXIT
+ *      cmds    - CMD_* kind, LIST_* op, stages first..first+count, meter prefix
+ *      stages  - words first..first+count, in/out file, redirect char
+ *      words   - offsets into the string table
+ *      strings - NUL terminated
+ *
+ *  lines whose meaning depends on when they run, globs, $? and process
+ *  substitutions, are kept as text and go through process() every time.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <string.h>
+#include    <stdint.h>
+#include    <fcntl.h>
+#include    <sys/mman.h>
+#include    <sys/stat.h>
+#include    "smsh.h"
+
+#define CACHE_SUFFIX ".smshc"
+#define CACHE_MAGIC "SMSHC05" // bump the number whenever the layout or the parse of a line changes
+#define NO_STR UINT32_MAX     // no redirect file
+#define MAX_CMD_STAGES 256    // larger commands stay as text, argv is built on the stack
+#define MAX_CMD_WORDS 65536
+
+#define LINE_RAW  0
+#define LINE_LIST 1
+#define LINE_EXIT 2
+
+struct cacheHeader {
+    char magic[8];
+    uint64_t srcSize;
+    int64_t srcMtime;
+    int64_t srcMtimeNsec;
+    uint64_t srcHash;
+    uint32_t flags;     // options that change how lines are compiled
+    uint32_t numLines, numCmds, numStages, numWords, strBytes;
+};
+
+struct cacheLine {
+    uint32_t kind, first, count;
+};
+
+struct cacheCmd {
+    uint32_t kind, op, first, count;
+    uint32_t meterMode, meterSize; // 0 unless the command had a meter prefix
+};
+
+struct cacheStage {
+    uint32_t first, count;
+    uint32_t inFile, outFile;
+    uint32_t redir;
+};
+
+struct cacheImage {
+    char *base;
+    size_t size;
+    int mapped;         // munmap base when done, else efree it
+    struct cacheHeader *hdr;
+    struct cacheLine *lines;
+    struct cacheCmd *cmds;
+    struct cacheStage *stages;
+    uint32_t *words;
+    char *strings;
+};
+
+struct buf {
+    char *data;
+    size_t len, cap;
+};
+
+/**
+ * append n bytes to a growing buffer
+ * @return where they went, as an offset into the buffer
+*/
+static size_t bufAdd(struct buf *b, const void *p, size_t n) {
+    size_t at = b->len;
+    if (b->len + n > b->cap) {
+        b->cap = (b->len + n) * 2 + 64;
+        b->data = erealloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return at;
+}
+
+static uint32_t addString(struct buf *strings, char *s) {
+    if (s == NULL)
+        return NO_STR;
+    return (uint32_t) bufAdd(strings, s, strlen(s) + 1);
+}
+
+static uint64_t fnv1a(const char *p, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    while (n-- > 0) {
+        h ^= (unsigned char) *p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint32_t compileFlags() {
+    return pipeOptimize ? 1 : 0;
+}
+
+/**
+ * point img at the sections of a cache image and check every index in it,
+ * so running it can't read outside the image however it was damaged
+ * @return YES if the image is usable
+*/
+static int openImage(struct cacheImage *img, char *base, size_t size) {
+    struct cacheHeader *h = (struct cacheHeader *) base;
+    uint64_t i, need;
+
+    if (size < sizeof(*h) || memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0)
+        return NO;
+    need = sizeof(*h) + (uint64_t) h->numLines * sizeof(struct cacheLine)
+           + (uint64_t) h->numCmds * sizeof(struct cacheCmd)
+           + (uint64_t) h->numStages * sizeof(struct cacheStage)
+           + (uint64_t) h->numWords * sizeof(uint32_t) + h->strBytes;
+    if (need != size || (h->strBytes > 0 && base[size - 1] != '\0'))
+        return NO;
+
+    img->base = base;
+    img->size = size;
+    img->hdr = h;
+    img->lines = (struct cacheLine *) (h + 1);
+    img->cmds = (struct cacheCmd *) (img->lines + h->numLines);
+    img->stages = (struct cacheStage *) (img->cmds + h->numCmds);
+    img->words = (uint32_t *) (img->stages + h->numStages);
+    img->strings = (char *) (img->words + h->numWords);
+
+    for (i = 0; i < h->numLines; i++) {
+        struct cacheLine *l = &img->lines[i];
+        if ((l->kind == LINE_RAW && l->first >= h->strBytes)
+            || (l->kind == LINE_LIST && (uint64_t) l->first + l->count > h->numCmds)
+            || l->kind > LINE_EXIT)
+            return NO;
+    }
+    for (i = 0; i < h->numCmds; i++) {
+        struct cacheCmd *c = &img->cmds[i];
+        uint64_t j, words = 0;
+        if (c->kind > CMD_ERROR || c->count > MAX_CMD_STAGES
+            || (uint64_t) c->first + c->count > h->numStages)
+            return NO;
+        for (j = c->first; j < c->first + c->count; j++)
+            words += img->stages[j].count;
+        if (words > MAX_CMD_WORDS)
+            return NO;
+    }
+    for (i = 0; i < h->numStages; i++) {
+        struct cacheStage *s = &img->stages[i];
+        if ((uint64_t) s->first + s->count > h->numWords
+            || (s->inFile != NO_STR && s->inFile >= h->strBytes)
+            || (s->outFile != NO_STR && s->outFile >= h->strBytes))
+            return NO;
+    }
+    for (i = 0; i < h->numWords; i++) {
+        if (img->words[i] >= h->strBytes)
+            return NO;
+    }
+    return YES;
+}
+
+/**
+ * does a line have to be parsed every time it runs
+*/
+static int isDynamic(char *line) {
+    // globs, $?, and <(...) >(...) which have to be started every time
+    return strpbrk(line, "*?[") != NULL || strstr(line, "<(") != NULL || strstr(line, ">(") != NULL;
+}
+
+/**
+ * compile the commands of one line, appending them to cmds/stages/words/strings
+ * @return NO if it has to stay as text, the caller rolls back what was appended
+*/
+static int compileList(char *line, struct buf *cmds, struct buf *stages, struct buf *words,
+                       struct buf *strings, uint32_t *numCmds) {
+    struct cmdlist *list;
+    int n, i, ok = YES;
+
+    list = splitlineList(line, &n);
+    for (i = 0; i < n && ok; i++) {
+        struct cacheCmd c = {CMD_NONE, list[i].op, stages->len / sizeof(struct cacheStage), 0, 0, 0};
+        struct command cmd;
+        int k, j, numWords = 0;
+
+        if (list[i].cmd[strspn(list[i].cmd, " \t")] != '\0') {
+            // a meter prefix is kept with the command, without one --meter decides at run time
+            char *scratch = estrndup(list[i].cmd, strlen(list[i].cmd));
+            int mode = 0, size = 0;
+            if (meterPrefix(scratch, &mode, &size)) {
+                c.meterMode = mode;
+                c.meterSize = size;
+            }
+            efree(scratch);
+
+            parseCommand(list[i].cmd, &cmd);
+            c.kind = cmd.kind;
+            c.count = cmd.numStages;
+            for (k = 0; k < cmd.numStages; k++) {
+                struct cacheStage s;
+                s.first = words->len / sizeof(uint32_t);
+                for (j = 0; cmd.pipes[k][j] != NULL; j++) {
+                    uint32_t at = addString(strings, cmd.pipes[k][j]);
+                    bufAdd(words, &at, sizeof(at));
+                }
+                s.count = j;
+                numWords += j;
+                s.inFile = addString(strings, cmd.inFiles != NULL ? cmd.inFiles[k] : NULL);
+                s.outFile = addString(strings, cmd.outFiles != NULL ? cmd.outFiles[k] : NULL);
+                s.redir = cmd.redirPos != NULL ? (unsigned char) cmd.redirPos[k] : '\0';
+                bufAdd(stages, &s, sizeof(s));
+            }
+            freeCommand(&cmd);
+            if (c.count > MAX_CMD_STAGES || numWords > MAX_CMD_WORDS)
+                ok = NO;
+        }
+        bufAdd(cmds, &c, sizeof(c));
+        (*numCmds)++;
+    }
+    freeCmdList(list, n);
+    return ok;
+}
+
+/**
+ * compile a script into a cache image
+ * @param src - the script, size bytes of it
+ * @param st - its stat, for the key
+ * @param image - set to the whole image, header first
+*/
+static void compileScript(char *src, size_t size, struct stat *st, struct buf *image) {
+    struct buf lines = {0}, cmds = {0}, stages = {0}, words = {0}, strings = {0};
+    struct cacheHeader h;
+    size_t pos = 0;
+
+    while (pos < size) {
+        char *nl = memchr(src + pos, '\n', size - pos);
+        size_t len = (nl != NULL ? nl - src : size) - pos;
+        char *line = estrndup(src + pos, len);
+        struct cacheLine l = {LINE_LIST, cmds.len / sizeof(struct cacheCmd), 0};
+
+        if ((pos == 0 && strncmp(line, "#!", 2) == 0) || line[strspn(line, " \t")] == '\0') {
+            // an interpreter line or nothing to run
+        } else if (strcmp(line, "exit") == 0) {
+            l.kind = LINE_EXIT;
+            bufAdd(&lines, &l, sizeof(l));
+        } else {
+            size_t marks[4] = {cmds.len, stages.len, words.len, strings.len};
+            if (isDynamic(line) || !compileList(line, &cmds, &stages, &words, &strings, &l.count)) {
+                cmds.len = marks[0];
+                stages.len = marks[1];
+                words.len = marks[2];
+                strings.len = marks[3];
+                l.kind = LINE_RAW;
+                l.first = addString(&strings, line);
+                l.count = 0;
+            }
+            bufAdd(&lines, &l, sizeof(l));
+        }
+        efree(line);
+        pos += len + 1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.srcSize = st->st_size;
+    h.srcMtime = st->st_mtim.tv_sec;
+    h.srcMtimeNsec = st->st_mtim.tv_nsec;
+    h.srcHash = fnv1a(src, size);
+    h.flags = compileFlags();
+    h.numLines = lines.len / sizeof(struct cacheLine);
+    h.numCmds = cmds.len / sizeof(struct cacheCmd);
+    h.numStages = stages.len / sizeof(struct cacheStage);
+    h.numWords = words.len / sizeof(uint32_t);
+    h.strBytes = strings.len;
+
+    memset(image, 0, sizeof(*image));
+    bufAdd(image, &h, sizeof(h));
+    bufAdd(image, lines.data, lines.len);
+    bufAdd(image, cmds.data, cmds.len);
+    bufAdd(image, stages.data, stages.len);
+    bufAdd(image, words.data, words.len);
+    bufAdd(image, strings.data, strings.len);
+
+    efree(lines.data);
+    efree(cmds.data);
+    efree(stages.data);
+    efree(words.data);
+    efree(strings.data);
+}
+
+/**
+ * write the image next to the script, through a temporary file so a
+ * concurrent run never maps half a cache. a script in a directory we
+ * can't write to just runs uncached
+*/
+static void saveCache(char *cachePath, struct buf *image) {
+    char tmpPath[strlen(cachePath) + 8];
+    size_t done = 0;
+    ssize_t w;
+    int fd;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", cachePath);
+    if ((fd = mkstemp(tmpPath)) == -1)
+        return;
+    while (done < image->len && (w = write(fd, image->data + done, image->len - done)) > 0)
+        done += w;
+    if (close(fd) == -1 || done != image->len || rename(tmpPath, cachePath) == -1)
+        unlink(tmpPath);
+}
+
+/**
+ * map the cache of a script if it is still good for it
+ * @param srcFD - the script, only read if the mtime changed but the size didn't
+ * @return YES with img set up
+*/
+static int loadCache(char *cachePath, int srcFD, struct stat *st, struct cacheImage *img) {
+    struct stat cst;
+    struct cacheHeader *h;
+    char *base;
+    int fd, ok = NO;
+
+    if ((fd = open(cachePath, O_RDONLY)) == -1)
+        return NO;
+    // only trust a cache we wrote ourselves, it is run without being looked at
+    if (fstat(fd, &cst) == -1 || cst.st_uid != geteuid() || cst.st_size < sizeof(*h)) {
+        close(fd);
+        return NO;
+    }
+    base = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NO;
+
+    h = (struct cacheHeader *) base;
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) == 0 && h->flags == compileFlags()
+        && h->srcSize == (uint64_t) st->st_size) {
+        if (h->srcMtime == st->st_mtim.tv_sec && h->srcMtimeNsec == st->st_mtim.tv_nsec) {
+            ok = YES;
+        } else if (st->st_size > 0) { // touched, see if the text really changed
+            char *src = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, srcFD, 0);
+            if (src != MAP_FAILED) {
+                ok = (fnv1a(src, st->st_size) == h->srcHash);
+                munmap(src, st->st_size);
+            }
+        }
+    }
+    if (ok && openImage(img, base, cst.st_size)) {
+        img->mapped = YES;
+        return YES;
+    }
+    munmap(base, cst.st_size);
+    return NO;
+}
+
+/**
+ * run one compiled command, its argv is built on the stack over the image
+ * @return the status returned by executeCommand
+*/
+static int runCached(struct cacheImage *img, struct cacheCmd *c) {
+    struct cacheStage *st = img->stages + c->first;
+    int n = c->count, total = n + 1, i, j;
+
+    for (i = 0; i < n; i++)
+        total += st[i].count;
+
+    char *words[total];
+    char **pipes[n + 1];
+    char *inFiles[n + 1], *outFiles[n + 1];
+    char redirPos[n + 1];
+    char **wp = words;
+    struct command cmd = {c->kind, n, pipes, inFiles, outFiles, redirPos,
+                          c->meterMode ? (int) c->meterMode : meterPipes, c->meterSize};
+
+    for (i = 0; i < n; i++) {
+        pipes[i] = wp;
+        for (j = 0; j < st[i].count; j++)
+            *wp++ = img->strings + img->words[st[i].first + j];
+        *wp++ = NULL;
+        inFiles[i] = st[i].inFile == NO_STR ? NULL : img->strings + st[i].inFile;
+        outFiles[i] = st[i].outFile == NO_STR ? NULL : img->strings + st[i].outFile;
+        redirPos[i] = st[i].redir;
+    }
+    pipes[n] = NULL;
+    return executeCommand(&cmd);
+}
+
+/**
+ * run every line of a compiled script, as the prompt loop would
+*/
+static void runImage(struct cacheImage *img) {
+    uint32_t i, k;
+    for (i = 0; i < img->hdr->numLines; i++) {
+        struct cacheLine *l = &img->lines[i];
+        if (l->kind == LINE_EXIT)
+            break;
+        if (l->kind == LINE_RAW) {
+            process(img->strings + l->first);
+            continue;
+        }
+        int run = YES;
+        memstatsLine();
+        for (k = l->first; k < l->first + l->count; k++) {
+            struct cacheCmd *c = &img->cmds[k];
+            if (run && c->kind != CMD_NONE)
+                lastStatus = exitCode(runCached(img, c));
+            run = listRuns(c->op);
+        }
+    }
+}
+
+/**
+ * run a script file, compiling it first if its cache is missing or stale
+ * @param path - the script
+ * @return exit code of the last command, as the shell's own exit code
+*/
+int runScript(char *path) {
+    struct stat st;
+    struct cacheImage img;
+    char cachePath[strlen(path) + sizeof(CACHE_SUFFIX)];
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        return 1;
+    }
+    snprintf(cachePath, sizeof(cachePath), "%s%s", path, CACHE_SUFFIX);
+
+    if (!loadCache(cachePath, fd, &st, &img)) {
+        struct buf image;
+        char *src = "";
+        if (st.st_size > 0 && (src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+            perror(path);
+            close(fd);
+            return 1;
+        }
+        compileScript(src, st.st_size, &st, &image);
+        if (st.st_size > 0)
+            munmap(src, st.st_size);
+        saveCache(cachePath, &image);
+        if (!openImage(&img, image.data, image.len))
+            fatal("bad script image", path, 1); // can't happen, we just built it
+        img.mapped = NO;
+    }
+    close(fd);
+
+    runImage(&img);
+
+    if (img.mapped)
+        munmap(img.base, img.size);
+    else
+        efree(img.base);
+    return lastStatus;
+}
@@ -0,0 +1,265 @@
+/* server.c - command server mode for smsh4
+ *
+ *    int serve(char *path, int maxClients) - serve command lines on a unix socket
+ *
+ *  protocol: a client writes newline terminated command lines, each one is
+ *  run through process() exactly as if it was typed at the prompt. the reply
+ *  to a line is a stream of frames, a text header followed by a payload:
+ *
+ *      out <n>\n<n bytes written to stdout>
+ *      err <n>\n<n bytes written to stderr>
+ *      status <code>\n                        (last frame for the line)
+ *
+ *  every client gets its own handler process which lives as long as the
+ *  connection does and runs its lines itself, so the shell isn't restarted
+ *  between lines and limits, coprocesses, loaded builtins and $? carry over.
+ */
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <unistd.h>
+#include    <signal.h>
+#include    <string.h>
+#include    <errno.h>
+#include    <poll.h>
+#include    <fcntl.h>
+#include    <sys/socket.h>
+#include    <sys/stat.h>
+#include    <sys/un.h>
+#include    <sys/wait.h>
+#include    "smsh.h"
+
+#define FRAME_BUF 65536
+
+/**
+ * write all n bytes to fd, retrying short writes
+ * @return 0 on success, -1 if the client went away
+*/
+static int writeAll(int fd, const char *buf, size_t n) {
+    ssize_t w;
+    while (n > 0) {
+        if ((w = send(fd, buf, n, MSG_NOSIGNAL)) == -1) { // a client going away is EPIPE, not a signal
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/**
+ * send one out/err frame to the client
+*/
+static int sendFrame(int fd, const char *type, const char *buf, size_t n) {
+    char header[32];
+    int len = snprintf(header, sizeof(header), "%s %zu\n", type, n);
+    if (writeAll(fd, header, len) == -1)
+        return -1;
+    return writeAll(fd, buf, n);
+}
+
+/**
+ * frame the handler's stdout and stderr for the client as they arrive,
+ * runs in its own process for the whole connection. after each command
+ * line the handler sends its status frame down ctlFD, that is passed on
+ * once everything the line wrote has been sent, then acked on ackFD so
+ * the next line's output can't overtake it.
+ * never returns, exits when the handler closes ctlFD
+*/
+static void relay(int clientFD, int outFD, int errFD, int ctlFD, int ackFD) {
+    static char buf[FRAME_BUF];
+    struct pollfd fds[3];
+    int dead = 0; // client hung up, keep reading so the commands can finish
+    int i;
+
+    fcntl(outFD, F_SETFL, O_NONBLOCK);
+    fcntl(errFD, F_SETFL, O_NONBLOCK);
+    fds[0].fd = outFD;
+    fds[1].fd = errFD;
+    fds[2].fd = ctlFD;
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            _exit(1);
+        }
+        int status = (fds[2].revents != 0);
+        // on a status, empty both pipes first, what the line wrote is all in them by now
+        for (i = 0; i < 2; i++) {
+            ssize_t n;
+            if (fds[i].revents == 0 && !status)
+                continue;
+            while ((n = read(fds[i].fd, buf, sizeof(buf))) > 0) {
+                if (!dead && sendFrame(clientFD, i == 0 ? "out" : "err", buf, n) == -1)
+                    dead = 1;
+                if (!status)
+                    break;
+            }
+            if (n == 0)
+                fds[i].fd = -1; // nothing holds it any more, stop polling it
+        }
+        if (status) {
+            ssize_t n = read(ctlFD, buf, sizeof(buf));
+            if (n <= 0)
+                _exit(0);
+            if (!dead && writeAll(clientFD, buf, n) == -1)
+                dead = 1;
+            write(ackFD, "", 1);
+        }
+    }
+}
+
+/**
+ * run command lines from a connected client until it hangs up or sends exit.
+ * they run in the handler itself, so everything the shell keeps (ulimit,
+ * coprocesses, loaded builtins, $?, memstats) carries over between lines.
+ * its stdout and stderr are pipes to the relay for the whole connection,
+ * its stdin is /dev/null.
+*/
+static void serveClient(int clientFD) {
+    int outPipe[2], errPipe[2], ctlPipe[2], ackPipe[2];
+    FILE *in;
+    char *cmdline;
+    char status[32], ack;
+    pid_t pid;
+
+    if (pipe(outPipe) == -1 || pipe(errPipe) == -1 || pipe(ctlPipe) == -1 || pipe(ackPipe) == -1) {
+        perror("pipe");
+        return;
+    }
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        close(outPipe[1]);
+        close(errPipe[1]);
+        close(ctlPipe[1]);
+        close(ackPipe[0]);
+        relay(clientFD, outPipe[0], errPipe[0], ctlPipe[0], ackPipe[1]);
+    }
+    close(outPipe[0]);
+    close(errPipe[0]);
+    close(ctlPipe[0]);
+    close(ackPipe[1]);
+    // the commands we run get neither the socket nor the relay's control pipes
+    fcntl(clientFD, F_SETFD, FD_CLOEXEC);
+    fcntl(ctlPipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(ackPipe[0], F_SETFD, FD_CLOEXEC);
+    fflush(stdout);
+    fflush(stderr);
+    // no input for the commands, not the server's stdin and never its terminal
+    int nullFD = open("/dev/null", O_RDONLY);
+    if (nullFD != -1) {
+        dup2(nullFD, STDIN_FILENO);
+        close(nullFD);
+    }
+    dup2(outPipe[1], STDOUT_FILENO);
+    dup2(errPipe[1], STDERR_FILENO);
+    close(outPipe[1]);
+    close(errPipe[1]);
+    // the handler is the shell now, commands get the usual SIGPIPE
+    signal(SIGPIPE, SIG_DFL);
+
+    if ((in = fdopen(clientFD, "r")) == NULL) {
+        perror("fdopen");
+        return;
+    }
+    while ((cmdline = next_cmd("", in)) != NULL) {
+        if (strcmp(cmdline, "exit") == 0) {
+            efree(cmdline);
+            break;
+        }
+        process(cmdline);
+        efree(cmdline);
+        fflush(stdout);
+        fflush(stderr);
+        int len = snprintf(status, sizeof(status), "status %d\n", lastStatus);
+        if (write(ctlPipe[1], status, len) != len || read(ackPipe[0], &ack, 1) != 1)
+            break;
+    }
+    close(ctlPipe[1]); // the relay goes once it sees this
+    waitpid(pid, NULL, 0);
+    fclose(in);
+}
+
+/**
+ * listen on a unix domain socket and serve clients, at most maxClients at once
+ * @param path - path of the socket, an old socket there is replaced
+ * @param maxClients - how many connections are handled concurrently
+ * @return only returns on error
+*/
+int serve(char *path, int maxClients) {
+    int listenFD, clientFD;
+    int active = 0; // handler processes still running
+    struct sockaddr_un addr;
+    pid_t pid;
+
+    if (maxClients < 1)
+        maxClients = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if ((listenFD = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        return 1;
+    }
+    // a socket left behind by an earlier server is replaced, anything else is kept
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+            close(listenFD);
+            return 1;
+        }
+        unlink(path);
+    }
+    if (bind(listenFD, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("bind");
+        return 1;
+    }
+    if (listen(listenFD, maxClients) == -1) {
+        perror("listen");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client going away must not take us with it
+
+    for (;;) {
+        // reap finished handlers, wait for one when we are at the limit
+        while (active > 0) {
+            pid = waitpid(-1, NULL, active >= maxClients ? 0 : WNOHANG);
+            if (pid <= 0)
+                break;
+            active--;
+        }
+
+        if ((clientFD = accept(listenFD, NULL, NULL)) == -1) {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+
+        if ((pid = fork()) == -1) {
+            perror("fork");
+            close(clientFD);
+        } else if (pid == 0) {
+            close(listenFD);
+            serveClient(clientFD);
+            _exit(0); // its output is flushed, the rest of its stdio is the listener's copy
+        } else {
+            close(clientFD);
+            active++;
+        }
+    }
+}
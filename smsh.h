@@ -1,16 +1,102 @@
 #define	YES	1
 #define	NO	0
 
+#define EXIT_STATUS(n)	((n) << 8)	/* exit code as a status returned via wait */
+
+#define LIST_END	0	/* how a command in a list joins the next one */
+#define LIST_SEQ	1	/* ; */
+#define LIST_AND	2	/* && */
+#define LIST_OR		3	/* || */
+
+struct cmdlist {
+    char *cmd;  /* one command or pipeline */
+    int op;     /* LIST_* joining it to the next command */
+};
+
+#define CMD_NONE	0	/* nothing to run */
+#define CMD_SIMPLE	1	/* one command, maybe a builtin */
+#define CMD_PIPE	2	/* cmd | cmd ..., may have been optimized down to one stage */
+#define CMD_FANOUT	3	/* cmd |> cmd ... */
+#define CMD_ERROR	4	/* could not be parsed, running it reports why */
+
+struct command {
+    int kind;           /* CMD_* */
+    int numStages;
+    char ***pipes;      /* argv of each stage, NULL terminated */
+    char **inFiles;     /* redirect files of each stage, NULL for none */
+    char **outFiles;
+    char *redirPos;     /* '<', '>' or '\0' for each stage of a CMD_PIPE */
+    int meterMode;      /* METER_* or 0 */
+    int meterSize;
+};
+
+#define MAX_PROCSUB	16	/* <(...) and >(...) in one command */
+
+struct procsubs {
+    int n;
+    int pids[MAX_PROCSUB];  /* the shells running them */
+    int fds[MAX_PROCSUB];   /* our end of each pipe, what /dev/fd/N refers to */
+};
+
+#define METER_END	1	/* report when the pipeline is done */
+#define METER_LIVE	2	/* and every second while it runs */
+
 char	*next_cmd(char *, FILE *);
 char    *globPattern(char * );
+char    **globWalk(char *, int *);
+void    freeGlobWalk(char **);
 char	**splitline(char *);
 char    ***splitlinePipe(char *, int);
+struct cmdlist *splitlineList(char *, int *);
+void    freeCmdList(struct cmdlist *, int);
 void	freelist(char **);
 void    free2dlist(char ***);
 void	*emalloc(size_t);
+void	*ecalloc(size_t, size_t);
 void	*erealloc(void *, size_t );
+char	*estrndup(const char *, size_t);
+void	efree(void *);
+void	memstatsLine();
+int	    builtinMemstats(char **);
+int	    builtinCoproc(char **);
+char	*coprocPath(char *, int);
+int	    builtinEnable(char **);
+int	    runLoadable(char **, char *, char *, int *);
+void	trimlist(char **, int);
+int	    spawnChild(char **, int, int, char *, char *, int, int);
 int	    execute(char **, char *, char *);
 int	    executePipe(char ***, int , char **, char **, const char *);
+int	    executeFanout(char ***, int);
+int	    executePipeMetered(char ***, int, char **, char **, const char *, int, int);
+int	    meterPrefix(char *, int *, int *);
+void	setPipeSize(int, int);
 void	fatal(char *, char *, int );
 
-int	process();
+struct rusage;
+int     builtinUlimit(char **);
+int     builtinLimit(char **, char *, char *);
+void    applyLimits();
+void    reportLimits(int, struct rusage *);
+char    **applySched(char **, int);
+int     schedWords(char **);
+
+int	process(char *);
+int	listRuns(int);
+void	parseCommand(char *, struct command *);
+int	executeCommand(struct command *);
+void	freeCommand(struct command *);
+int	runScript(char *);
+int	startProcSubst(char **, struct procsubs *);
+void	finishProcSubst(struct procsubs *);
+int	serve(char *, int);
+int	exitCode(int);
+int	    optimizePipe(char ***, int, char **, char **, char *);
+void	printPipePlan(char ***, int, char **, char **, const char *);
+
+extern int lastStatus;
+extern int pipeOptimize;
+extern int pipeSize;
+extern int argBatchJobs;
+extern int meterPipes;
+extern int showPlan;
+extern int spreadStages;
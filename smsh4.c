@@ -6,6 +6,30 @@
  *     This version of shell performs all of the
  *     shell operations of smsh3, but also allows
  *     globbing in comands
+ *
+ *     smsh4 --server PATH [--max-clients N] runs the shell as a
+ *     command server on a unix domain socket, see server.c
+ *     --no-pipeopt turns off the pipeline optimizer (pipeopt.c)
+ *     --show-plan prints every pipeline as it is about to be run
+ *     cmd |> a |> b sends the output of cmd to both a and b, see fanout.c
+ *     --meter / --meter-live, or a "meter [-l] [-s SIZE]" prefix on a line,
+ *     reports the throughput of each pipeline stage, see meter.c
+ *     --pipe-size N sets the capacity of every pipe the shell creates
+ *     commands can be joined with ;, && and ||, $? is the last exit code
+ *     ulimit and limit set resource limits for commands, see limits.c
+ *     memstats prints the shell's allocation counters, resident size and open fds, see memstats.c
+ *     --batch-jobs N runs up to N batches at once when a command's
+ *     arguments are too big for ARG_MAX and execute splits them up
+ *     coproc NAME cmd starts a helper that later commands reach with
+ *     > @NAME and < @NAME, see coproc.c
+ *     enable -f lib.so NAME loads a builtin from a shared object so it runs
+ *     without a fork, see loadable.c and smsh_builtin.h
+ *     <(cmd) and >(cmd) are replaced by a /dev/fd pipe to cmd, see procsub.c
+ *     a "sched [-c CPUS] [-n NICE] [-i CLASS[:LEVEL]]" prefix on a command or
+ *     pipeline stage sets its cpu affinity, nice level and io priority, and
+ *     --spread pins every pipeline stage to a cpu of its own, see sched.c
+ *     smsh4 script runs a file of command lines, compiling it once into
+ *     script.smshc which later runs execute from directly, see scriptcache.c
 */
 
 #include <stdio.h>
@@ -18,12 +42,194 @@
 #define DFL_PROMPT "> "
 #define MAX_PIPE 20
 
-int main() {
-    // initialise strings
-    char *cmdline = "", *prompt, **arglist;
+#define DFL_MAX_CLIENTS 8
+
+int lastStatus = 0; // exit code of the last command, $?
+
+static int runCommand(char *);
+static char *expandStatus(char *);
+static int runBuiltin(char **, char *, char *, int *);
+
+int main(int argc, char *argv[]) {
+    char *cmdline, *prompt;
+    char *sockPath = NULL; // set when running as a command server
+    char *script = NULL;   // set when running a script file
+    int maxClients = DFL_MAX_CLIENTS;
+    void setup();
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            sockPath = argv[++i];
+        } else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+            maxClients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-pipeopt") == 0) {
+            pipeOptimize = NO;
+        } else if (strcmp(argv[i], "--show-plan") == 0) {
+            showPlan = YES;
+        } else if (strcmp(argv[i], "--meter") == 0) {
+            meterPipes = METER_END;
+        } else if (strcmp(argv[i], "--meter-live") == 0) {
+            meterPipes = METER_LIVE;
+        } else if (strcmp(argv[i], "--pipe-size") == 0 && i + 1 < argc) {
+            pipeSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch-jobs") == 0 && i + 1 < argc) {
+            argBatchJobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spread") == 0) {
+            spreadStages = YES;
+        } else if (argv[i][0] != '-' && script == NULL && sockPath == NULL) {
+            script = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--no-pipeopt] [--show-plan] [--meter | --meter-live] [--pipe-size N]\n"
+                            "       [--batch-jobs N] [--spread] [--server PATH [--max-clients N] | script]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    prompt = DFL_PROMPT;
+    setup();
+
+    if (sockPath != NULL) {
+        return serve(sockPath, maxClients);
+    }
+    if (script != NULL) {
+        return runScript(script);
+    }
+
+    while ((cmdline = next_cmd(prompt, stdin)) != NULL) {
+        if (strcmp(cmdline, "exit") == 0) {
+            efree(cmdline);
+            return 0;
+        }
+        process(cmdline);
+        efree(cmdline);
+    }
+
+    return 0;
+}
+
+
+/**
+ * run a command line made of commands joined by ;, && and ||
+ * each command only runs if the status of the ones before it says so,
+ * and $? in it is replaced by the exit code of the last one that ran
+ * @param line - the command line, left untouched
+ * @return the status of the last command that ran, 0 if nothing was run
+*/
+int process(char *line) {
+    int numCmds, i;
+    int result = 0;
+    int run = YES; // does the next command in the list run
+    struct cmdlist *list;
+
+    memstatsLine();
+    list = splitlineList(line, &numCmds);
+
+    for (i = 0; i < numCmds; i++) {
+        if (run && list[i].cmd[strspn(list[i].cmd, " \t")] != '\0') {
+            char *cmd = expandStatus(list[i].cmd);
+            struct procsubs subs;
+            if (startProcSubst(&cmd, &subs) == -1) {
+                result = -1;
+            } else {
+                result = runCommand(cmd);
+                finishProcSubst(&subs);
+            }
+            lastStatus = exitCode(result);
+            efree(cmd);
+        }
+        run = listRuns(list[i].op);
+    }
+    freeCmdList(list, numCmds);
+    return result;
+}
+
+/**
+ * does the command after one joined by op run, given the last exit code
+ * a skipped command leaves $? alone, so a && b || c still runs c when a fails
+ * @param op - LIST_* joining the command to the next one
+*/
+int listRuns(int op) {
+    if (op == LIST_AND)
+        return lastStatus == 0;
+    if (op == LIST_OR)
+        return lastStatus != 0;
+    return YES;
+}
+
+/**
+ * copy a command replacing every $? with the last exit code
+*/
+static char *expandStatus(char *cmd) {
+    char code[16];
+    int codeLen = snprintf(code, sizeof(code), "%d", lastStatus);
+    char *expanded = emalloc(strlen(cmd) * (codeLen > 2 ? codeLen : 2) + 1);
+    char *out = expanded;
+
+    while (*cmd != '\0') {
+        if (cmd[0] == '$' && cmd[1] == '?') {
+            memcpy(out, code, codeLen);
+            out += codeLen;
+            cmd += 2;
+        } else {
+            *out++ = *cmd++;
+        }
+    }
+    *out = '\0';
+    return expanded;
+}
+
+/**
+ * is a word after a redirect the file, a coprocess is @NAME
+*/
+static int isRedirFile(char *word) {
+    return strchr(word, '.') != NULL || word[0] == '@';
+}
+
+/**
+ * the file a simple command redirects with op, the word after the last op
+ * @return a copy of the word, NULL if there is no op or no word after it
+*/
+static char *redirWord(char *cmdline, char op) {
+    char *cp, *word = NULL;
+    size_t len;
+    for (cp = strchr(cmdline, op); cp != NULL; cp = strchr(cp + 1, op))
+        word = cp + 1;
+    if (word == NULL)
+        return NULL;
+    word += strspn(word, " \t");
+    len = strcspn(word, " \t<>|");
+    return len > 0 ? estrndup(word, len) : NULL;
+}
+
+/**
+ * run a single command, see parseCommand and executeCommand
+ * @param line - the command, left untouched
+ * @return the status returned by execute/executePipe, 0 if nothing was run
+*/
+static int runCommand(char *line) {
+    struct command cmd;
+    int result;
+
+    parseCommand(line, &cmd);
+    result = executeCommand(&cmd);
+    freeCommand(&cmd);
+    return result;
+}
+
+/**
+ * parse a single command: expand its globs, split it into stages and pull
+ * out the redirect files, ready for executeCommand
+ * @param line - the command, left untouched
+ * @param cmd - filled in, release it with freeCommand
+*/
+void parseCommand(char *line, struct command *cmd) {
+    // work on our own copy, globbing rewrites the command line
+    char *cmdline = estrndup(line, strlen(line)), **arglist;
     // these are for the event of a pipe
     char ***pipes;
     int doPipe = 0;
+    int doFanout = 0; // number of |> seen
     int doInputRedir = 0;
     int doOutputRedir = 0;
 
@@ -32,187 +238,263 @@ int main() {
     int inFirst = 0;
     int outFirst = 0;
 
-    int result;
-    void setup();
+    cmd->kind = CMD_NONE;
+    cmd->numStages = 0;
+    cmd->pipes = NULL;
+    cmd->inFiles = NULL;
+    cmd->outFiles = NULL;
+    cmd->redirPos = NULL;
 
-    prompt = DFL_PROMPT;
-    setup();
+    // meter prefix on this line, otherwise whatever --meter asked for
+    cmd->meterMode = meterPipes;
+    cmd->meterSize = 0;
+    meterPrefix(cmdline, &cmd->meterMode, &cmd->meterSize);
 
-    while ((cmdline = next_cmd(prompt, stdin)) != NULL) {
-        int numCommands = 1;
-        int i;
-        for (i = 0; i < strlen(cmdline); i++) {
-            if (cmdline[i] == '|') {
-                doPipe = 1;
-                numCommands++;
+    int numCommands = 1;
+    int i;
+    for (i = 0; i < strlen(cmdline); i++) {
+        if (cmdline[i] == '|') {
+            doPipe = 1;
+            numCommands++;
+            if (cmdline[i + 1] == '>') { // |> fans the first command's output out
+                doFanout++;
+                i++;
+                continue;
             }
-            if (cmdline[i] == '<') {
-                doInputRedir = 1;
-                // same cmd multi-redirect is only supported for no pipes in cmd
-                if (!outFirst || numCommands > 1) {
-                    redirPos[numCommands - 1] = '<';
-                    if (numCommands == 1)
-                        inFirst = 1;
-                } else  {
-                    redirPos[numCommands] = '<';
-                    inFirst = 0;
-                }
+        }
+        if (cmdline[i] == '<') {
+            doInputRedir = 1;
+            // same cmd multi-redirect is only supported for no pipes in cmd
+            if (!outFirst || numCommands > 1) {
+                redirPos[numCommands - 1] = '<';
+                if (numCommands == 1)
+                    inFirst = 1;
+            } else  {
+                redirPos[numCommands] = '<';
+                inFirst = 0;
             }
-            if (cmdline[i] == '>') {
-                doOutputRedir = 1;
-                if (!inFirst || numCommands > 1) {
-                    redirPos[numCommands - 1] = '>';
-                    if (numCommands == 1){
-                        outFirst = 1;
-                    }
-                } else {
-                    redirPos[numCommands] = '>';
-                    outFirst = 0;
+        }
+        if (cmdline[i] == '>') {
+            doOutputRedir = 1;
+            if (!inFirst || numCommands > 1) {
+                redirPos[numCommands - 1] = '>';
+                if (numCommands == 1){
+                    outFirst = 1;
                 }
+            } else {
+                redirPos[numCommands] = '>';
+                outFirst = 0;
             }
-            if (cmdline[i] == '*' || cmdline[i] == '?' || cmdline[i] == '[') {
-                size_t cmdlen = strlen(cmdline);
-                char *wildcard = malloc(cmdlen); // create string to use as a wildcard check
-                int wildClen = 0;
-                int t = i; // so we may go back to where we were in for loop
-
-                // go back to start of wildcard word
-                while (cmdline[i] != ' ' && cmdline[i] != '\"') {
-                    i--;
-                }
-                int wildCStart = i + 1;
-                while (cmdline[i] == ' ') i++; // step forward once to ensure we're not still on space
-                while (cmdline[i] != ' ' && cmdline[i] != '\0') { // build wildcard string
-                    wildcard[wildClen] = cmdline[i];
-                    wildClen++;
-                    i++;
-                }
-                wildcard[wildClen] = '\0'; // null terminate the wildcard string
-                char *glob = globPattern(wildcard); // generate a string of matches
-
-                // create strings up until wildcard and after the wildcard
-                char *beforeGlob = strndup(cmdline, wildCStart);
-                char *afterGlob = strndup(cmdline + wildCStart + wildClen, (cmdlen - (wildCStart + wildClen)));
-
-                // start concatenating the pieces, ensuring to realloc enough memory at each step
-                char *newCmdline = strndup(beforeGlob, strlen(beforeGlob));
-                if (glob != NULL) {
-                    newCmdline = erealloc(newCmdline, strlen(newCmdline) + strlen(glob) + 1);
-                    strcat(newCmdline, glob);
-                    i = t + (strlen(glob));
-                }
-                newCmdline = erealloc(newCmdline, strlen(newCmdline) + strlen(afterGlob) + 1);
-                strcat(newCmdline, afterGlob);
-                newCmdline = erealloc(newCmdline, strlen(newCmdline) + 1);
-                strcat(newCmdline, "\0");
-                // make cmdline a duplicate of our newcmdline string
-                cmdline = strndup(newCmdline, strlen(newCmdline));
-
-                // cleanup
-                free(newCmdline);
-                free(glob);
-                free(beforeGlob);
-                free(afterGlob);
-                free(wildcard);
+        }
+        if (cmdline[i] == '*' || cmdline[i] == '?' || cmdline[i] == '[') {
+            size_t cmdlen = strlen(cmdline);
+            char *wildcard = emalloc(cmdlen + 1); // create string to use as a wildcard check
+            int wildClen = 0;
+            int t = i; // so we may go back to where we were in for loop
+
+            // go back to start of wildcard word
+            while (cmdline[i] != ' ' && cmdline[i] != '\"') {
+                i--;
+            }
+            int wildCStart = i + 1;
+            while (cmdline[i] == ' ') i++; // step forward once to ensure we're not still on space
+            while (cmdline[i] != ' ' && cmdline[i] != '\0') { // build wildcard string
+                wildcard[wildClen] = cmdline[i];
+                wildClen++;
+                i++;
             }
+            wildcard[wildClen] = '\0'; // null terminate the wildcard string
+            char *glob = globPattern(wildcard); // generate a string of matches
+
+            // create strings up until wildcard and after the wildcard
+            char *beforeGlob = estrndup(cmdline, wildCStart);
+            char *afterGlob = estrndup(cmdline + wildCStart + wildClen, (cmdlen - (wildCStart + wildClen)));
+
+            // start concatenating the pieces, ensuring to realloc enough memory at each step
+            char *newCmdline = estrndup(beforeGlob, strlen(beforeGlob));
+            if (glob != NULL) {
+                newCmdline = erealloc(newCmdline, strlen(newCmdline) + strlen(glob) + 1);
+                strcat(newCmdline, glob);
+                i = t + (strlen(glob));
+            }
+            newCmdline = erealloc(newCmdline, strlen(newCmdline) + strlen(afterGlob) + 1);
+            strcat(newCmdline, afterGlob);
+            newCmdline = erealloc(newCmdline, strlen(newCmdline) + 1);
+            strcat(newCmdline, "\0");
+            // newCmdline replaces cmdline from here on
+            efree(cmdline);
+            cmdline = newCmdline;
+
+            // cleanup
+            efree(glob);
+            efree(beforeGlob);
+            efree(afterGlob);
+            efree(wildcard);
         }
-        if (strcmp(cmdline, "exit") == 0) {
-            return 0;
+    }
+    if (doFanout) {
+        if (doFanout != numCommands - 1 || doInputRedir || doOutputRedir) {
+            cmd->kind = CMD_ERROR;
+        } else {
+            cmd->kind = CMD_FANOUT;
+            cmd->pipes = splitlinePipe(cmdline, numCommands);
+            cmd->numStages = numCommands;
         }
-        if (doPipe) {
-            // split the command line into as many pipes as there are
-            pipes = splitlinePipe(cmdline, numCommands);
-            int k;
-            char *outFiles[numCommands]; // holds files for input/output redirection
-            char *inFiles[numCommands];
-            for (k = 0; pipes[k] != NULL; k++) {
-                int j;
-                outFiles[k] = NULL; // initialise all values with NULL
-                inFiles[k] = NULL; // avoid free errors when we want to free the list
-                for (j = 0; pipes[k][j] != NULL; j++) {
-                    if ((strchr(pipes[k][j], '.') != NULL)) {
-
-                        if (doOutputRedir) {
-                            if (redirPos[k] == '>') {
-                                outFiles[k] = strndup(pipes[k][j], strlen(pipes[k][j]));
-                                pipes[k][j] = NULL;
-                            }
+    } else if (doPipe) {
+        // split the command line into as many pipes as there are
+        pipes = splitlinePipe(cmdline, numCommands);
+        int k;
+        // holds files for input/output redirection, all NULL to start with
+        char **outFiles = ecalloc(numCommands, sizeof(char *));
+        char **inFiles = ecalloc(numCommands, sizeof(char *));
+        for (k = 0; pipes[k] != NULL; k++) {
+            int j;
+            for (j = 0; pipes[k][j] != NULL; j++) {
+                if (isRedirFile(pipes[k][j])) {
 
+                    if (doOutputRedir) {
+                        if (redirPos[k] == '>') {
+                            efree(outFiles[k]);
+                            outFiles[k] = pipes[k][j];
+                            pipes[k][j] = NULL;
                         }
-                        if (doInputRedir) {
-                            if (redirPos[k] == '<') {
-                                inFiles[k] = strndup(pipes[k][j], strlen(pipes[k][j]));
-                                pipes[k][j] = NULL;
-                            }
 
-                        }
                     }
-                }
+                    if (doInputRedir) {
+                        if (redirPos[k] == '<') {
+                            efree(inFiles[k]);
+                            inFiles[k] = pipes[k][j];
+                            pipes[k][j] = NULL;
+                        }
 
-            }
-            // execute the commands
-            result = executePipe(pipes, numCommands, inFiles, outFiles, redirPos);
-
-            // cleanup for next cmdLine
-            free2dlist(pipes);
-            if (doOutputRedir) {
-                int m;
-                for (m = 0; m < numCommands; m++) {
-                    if (outFiles[m] != NULL) {
-                        free(outFiles[m]);
-                    }
-                }
-            }
-            if (doInputRedir) {
-                int m;
-                for (m = 0; m < numCommands; m++) {
-                    if (inFiles[m] != NULL) {
-                        free(inFiles[m]);
                     }
                 }
             }
+            trimlist(pipes[k], j); // anything after a redirect isn't part of the command
 
-        } else if ((arglist = splitline(cmdline)) != NULL) {
-            int k;
-            char *inFile = NULL;
-            char *outFile = NULL;
-            for (k = 0; arglist[k] != NULL; k++) {
-                if ((strchr(arglist[k], '.') != NULL)) { // if we see a '.' we probably are dealing with redir
-                    if (doOutputRedir || doInputRedir) { // but not necessarily so double check (ie rm word.txt)
-                        if (doInputRedir) {
-                            if (outFirst) {
-                                outFirst = 0;
-                                continue;
-                            }
-                            inFile = strndup(arglist[k], strlen(arglist[k]));
-                        }
-                        if (doOutputRedir) {
-                            if (inFirst) {
-                                inFirst = 0;
-                                continue;
-                            }
-                            outFile = strndup(arglist[k], strlen(arglist[k]));
-                        }
-                        arglist[k] = NULL; // replace the command with null terminator as it's not an actual command
-                    }
-                }
-            }
-            result = execute(arglist, inFile, outFile);
-            // cleanup for next cmdLine
+        }
+        // drop redundant stages, a pipeline may shrink down to a single command
+        cmd->kind = CMD_PIPE;
+        cmd->numStages = optimizePipe(pipes, numCommands, inFiles, outFiles, redirPos);
+        cmd->pipes = pipes;
+        cmd->inFiles = inFiles;
+        cmd->outFiles = outFiles;
+        cmd->redirPos = emalloc(numCommands); // not a string, stages without a redirect hold '\0'
+        memcpy(cmd->redirPos, redirPos, numCommands);
+
+    } else if ((arglist = splitline(cmdline)) != NULL) {
+        // each file is the word after its own operator, whichever comes first
+        char *inFile = doInputRedir ? redirWord(cmdline, '<') : NULL;
+        char *outFile = doOutputRedir ? redirWord(cmdline, '>') : NULL;
+        if (doInputRedir || doOutputRedir) { // the command is the words before the first redirect
+            char *head = estrndup(cmdline, strcspn(cmdline, "<>"));
             freelist(arglist);
-            free(inFile);
-            free(outFile);
+            arglist = splitline(head);
+            efree(head);
         }
-        // cleanup for next cmdLine
-        free(cmdline);
-        doPipe = 0;
-        doOutputRedir = 0;
-        doInputRedir = 0;
-        inFirst = 0;
-        outFirst = 0;
+
+        cmd->kind = CMD_SIMPLE;
+        cmd->numStages = 1;
+        cmd->pipes = ecalloc(2, sizeof(char **));
+        cmd->pipes[0] = arglist;
+        cmd->inFiles = ecalloc(1, sizeof(char *));
+        cmd->inFiles[0] = inFile;
+        cmd->outFiles = ecalloc(1, sizeof(char *));
+        cmd->outFiles[0] = outFile;
     }
+    // cleanup for next cmdLine
+    efree(cmdline);
+}
 
-    return 0;
+/**
+ * run a command filled in by parseCommand, or built over a compiled script
+ * nothing in cmd is changed or freed
+ * @return the status returned by execute/executePipe, 0 if nothing was run
+*/
+int executeCommand(struct command *cmd) {
+    int result = 0;
+    // redirects to and from a coprocess go to its pipes
+    char *inFiles[cmd->numStages + 1], *outFiles[cmd->numStages + 1];
+    int i;
+
+    for (i = 0; i < cmd->numStages && cmd->inFiles != NULL; i++) {
+        inFiles[i] = coprocPath(cmd->inFiles[i], NO);
+        outFiles[i] = coprocPath(cmd->outFiles[i], YES);
+        if ((inFiles[i] == NULL && cmd->inFiles[i] != NULL) || (outFiles[i] == NULL && cmd->outFiles[i] != NULL))
+            return -1;
+    }
+
+    if (cmd->kind == CMD_ERROR) {
+        fprintf(stderr, "Error: |> can't be mixed with | or redirection\n");
+        result = -1;
+    } else if (cmd->kind == CMD_FANOUT) {
+        result = executeFanout(cmd->pipes, cmd->numStages);
+    } else if (cmd->kind == CMD_PIPE) {
+        if (showPlan) {
+            printPipePlan(cmd->pipes, cmd->numStages, cmd->inFiles, cmd->outFiles, cmd->redirPos);
+        }
+        if (cmd->numStages > 1 && cmd->meterMode) {
+            result = executePipeMetered(cmd->pipes, cmd->numStages, inFiles, outFiles, cmd->redirPos,
+                                        cmd->meterMode, cmd->meterSize);
+        } else if (cmd->numStages > 1) {
+            result = executePipe(cmd->pipes, cmd->numStages, inFiles, outFiles, cmd->redirPos);
+        } else {
+            result = execute(cmd->pipes[0], inFiles[0], outFiles[0]);
+        }
+    } else if (cmd->kind == CMD_SIMPLE) {
+        if (!runBuiltin(cmd->pipes[0], inFiles[0], outFiles[0], &result)) {
+            result = execute(cmd->pipes[0], inFiles[0], outFiles[0]);
+        }
+    }
+    return result;
+}
+
+/**
+ * release what parseCommand allocated
+*/
+void freeCommand(struct command *cmd) {
+    int i;
+    if (cmd->pipes != NULL) {
+        free2dlist(cmd->pipes);
+    }
+    // stages dropped by the optimizer have already given up their files
+    for (i = 0; i < cmd->numStages; i++) {
+        if (cmd->inFiles != NULL)
+            efree(cmd->inFiles[i]);
+        if (cmd->outFiles != NULL)
+            efree(cmd->outFiles[i]);
+    }
+    efree(cmd->inFiles);
+    efree(cmd->outFiles);
+    efree(cmd->redirPos);
+}
+
+
+
+
+/**
+ * run a simple command in the shell itself if it is one of our builtins
+ * @param result - set to the builtin's status, as execute would return it
+ * @return YES if the command was a builtin
+*/
+static int runBuiltin(char **arglist, char *inFile, char *outFile, int *result) {
+    if (arglist[0] == NULL) {
+        return NO;
+    }
+    if (strcmp(arglist[0], "ulimit") == 0) {
+        *result = builtinUlimit(arglist);
+    } else if (strcmp(arglist[0], "limit") == 0) {
+        *result = builtinLimit(arglist, inFile, outFile);
+    } else if (strcmp(arglist[0], "memstats") == 0) {
+        *result = builtinMemstats(arglist);
+    } else if (strcmp(arglist[0], "coproc") == 0) {
+        *result = builtinCoproc(arglist);
+    } else if (strcmp(arglist[0], "enable") == 0) {
+        *result = builtinEnable(arglist);
+    } else {
+        return runLoadable(arglist, inFile, outFile, result);
+    }
+    return YES;
 }
 
 
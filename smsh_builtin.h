@@ -0,0 +1,30 @@
+/* smsh_builtin.h - the interface for builtins loaded into smsh4 with enable -f
+ *
+ *  a shared object provides a builtin NAME by exporting
+ *
+ *      struct smsh_builtin smsh_builtin_NAME = {SMSH_BUILTIN_ABI, "NAME", fn, "usage"};
+ *
+ *  and is loaded with "enable -f ./lib.so NAME". fn runs inside the shell
+ *  process in place of fork/exec, with argv as the command would have got it
+ *  and the fds its stdin and stdout are redirected to. it returns the exit
+ *  code for $?. it must not exit, leave fds open or keep pointers into argv,
+ *  and it must flush anything it buffers before returning.
+ *
+ *      build: gcc -shared -fPIC -o lib.so lib.c
+ */
+
+#ifndef SMSH_BUILTIN_H
+#define SMSH_BUILTIN_H
+
+#define SMSH_BUILTIN_ABI 1  /* bumped whenever the struct or the call changes */
+
+typedef int smsh_builtin_fn(int argc, char **argv, int infd, int outfd);
+
+struct smsh_builtin {
+    int abi;                /* SMSH_BUILTIN_ABI it was built against */
+    const char *name;
+    smsh_builtin_fn *fn;
+    const char *usage;      /* shown by enable, may be NULL */
+};
+
+#endif
@@ -9,14 +9,13 @@
 #include	<stdlib.h>
 #include	<string.h>
 #include	"smsh.h"
-#include    <glob.h>
 
 char * next_cmd(char *prompt, FILE *fp)
 /*
  * purpose: read next command line from fp
  * returns: dynamically allocated string holding command line
  *  errors: NULL at EOF (not really an error)
- *          calls fatal from emalloc()
+ *          calls fatal from ecalloc()
  *   notes: allocates space in BUFSIZ chunks.  
  */
 {
@@ -32,7 +31,7 @@ char * next_cmd(char *prompt, FILE *fp)
 		/* need space? */
 		if( pos+1 >= bufspace ){		/* 1 for \0	*/
 			if ( bufspace == 0 )		/* y: 1st time	*/
-				buf = calloc(BUFSIZ, 1);
+				buf = ecalloc(BUFSIZ, 1);
 
 			else				/* or expand	*/
 				buf = erealloc(buf,bufspace+BUFSIZ);
@@ -84,7 +83,7 @@ char ** splitline(char *line)
 	if ( line == NULL )			/* handle special case	*/
 		return NULL;
 
-	args     = calloc(BUFSIZ, 1);		/* initialize array	*/
+	args     = ecalloc(BUFSIZ, 1);		/* initialize array	*/
 	bufspace = BUFSIZ;
 	spots    = BUFSIZ/sizeof(char *);
 
@@ -107,13 +106,78 @@ char ** splitline(char *line)
 		len   = 1;
 		while (*++cp != '\0' && !(is_delim(*cp)) )
 			len++;
-		args[argnum++] = strndup(start, len);
+		args[argnum++] = estrndup(start, len);
 	}
 	args[argnum] = NULL;
 	return args;
 }
 
 
+/**
+ * splitlineList ( split a line into the commands joined by ;, && and || )
+ * @param line - the line to be split
+ * @param numCmds - set to the number of commands found
+ * @return an array of commands, each with the operator that follows it
+*/
+struct cmdlist * splitlineList(char *line, int *numCmds) {
+	int spots = 4; // room in the list
+	int n = 0;
+	struct cmdlist *list = emalloc(sizeof(struct cmdlist) * spots);
+	char *cp = line, *start = line;
+	int depth = 0; // inside <(...), where the operators belong to the inner command
+
+	for (;;) {
+		int op, opLen = 2;
+		if (*cp == '(' || (*cp == ')' && depth > 0)) {
+			depth += (*cp == '(') ? 1 : -1;
+			cp++;
+			continue;
+		}
+		if (*cp == '\0') {
+			op = LIST_END;
+			opLen = 0;
+		} else if (depth > 0) {
+			cp++;
+			continue;
+		} else if (*cp == ';') {
+			op = LIST_SEQ;
+			opLen = 1;
+		} else if (cp[0] == '&' && cp[1] == '&') {
+			op = LIST_AND;
+		} else if (cp[0] == '|' && cp[1] == '|') {
+			op = LIST_OR;
+		} else {
+			cp++;
+			continue;
+		}
+
+		if (n == spots) {
+			spots *= 2;
+			list = erealloc(list, sizeof(struct cmdlist) * spots);
+		}
+		list[n].cmd = estrndup(start, cp - start);
+		list[n].op = op;
+		n++;
+		if (op == LIST_END)
+			break;
+		cp += opLen;
+		start = cp;
+	}
+	*numCmds = n;
+	return list;
+}
+
+/**
+ * free the list returned by splitlineList
+ */
+void freeCmdList(struct cmdlist *list, int numCmds) {
+	int i;
+	for (i = 0; i < numCmds; i++) {
+		efree(list[i].cmd);
+	}
+	efree(list);
+}
+
 #define intSize sizeof(int) // size of an int in bytes
 /**
  * splitlinePipe ( parse a line into two arrays of strings, split by a pipe )
@@ -126,12 +190,12 @@ char *** splitlinePipe(char* line, int numCommands) {
 	int * pipePositions; // positions of the pipe
 	int lineLen = strlen(line); // length of the line
 
-    char *** commandList = calloc(numCommands + 2, BUFSIZ); // ensure enough space for each individual command
 	if (line == NULL) { // if the line is null, return null
 		return NULL;
 	}
+    char *** commandList = ecalloc(numCommands + 2, sizeof(char **)); // one slot per command, NULL terminated
 
-	pipePositions = calloc((intSize * (numCommands + 1) ), intSize); // allocate memory for int array
+	pipePositions = ecalloc(numCommands + 1, intSize); // allocate memory for int array
 
 	int pipeIndex = 0; // index of the current pipe
 	// find the position of the pipe
@@ -145,63 +209,58 @@ char *** splitlinePipe(char* line, int numCommands) {
 	pipePositions[pipeIndex] = lineLen; // add the length of the line to the array
 
 	char * pipeString;
-    pipeString = strndup(line, pipePositions[0]);
+    pipeString = estrndup(line, pipePositions[0]);
 	// split the line into strings before and after each pipe
 	for (i = 0; i < numCommands; i++) {
         commandList[i] = splitline(pipeString);
+		efree(pipeString); // splitline copied what it needed
 		int pipeStringLen = pipePositions[i+1] - pipePositions[i]; // length of the string between the pipes
-		pipeString = strndup(line + pipePositions[i], pipeStringLen);
+		pipeString = estrndup(line + pipePositions[i], pipeStringLen);
 
 	}
     commandList[numCommands] = NULL;
-	free(pipeString);
-    free(pipePositions);
+	efree(pipeString);
+    efree(pipePositions);
     return commandList;
 }
 
 /**
  * given a wildcard character, returns a list of path names in a single string
  * seperated by spaces
- * ref: https://stackoverflow.com/questions/36757641/how-to-use-the-glob-function
+ * matching is done by globWalk (globwalk.c), which also understands ** for
+ * any number of directories
  * @param wildCard : the wildcard to use as our search term
  */
 char * globPattern(char * wildCard) {
     int length = 0;
     int numMatch = 0;
-    glob_t result;
+    char ** result;
     char ** list;
 
-    int err = glob(wildCard, GLOB_ERR, NULL, &result);
-    if (err != 0) {
-        if (err == GLOB_NOMATCH) {
-            perror("No matches found for your wildcard!");
-        } else {
-            perror("Issue with globbing");
-        }
+    result = globWalk(wildCard, &numMatch);
+    if (numMatch == 0) {
+        perror("No matches found for your wildcard!");
+        freeGlobWalk(result);
         return NULL;
     }
 
     // find how many strings we need space for
-    for (list = result.gl_pathv, numMatch = result.gl_pathc;
-        // gl_pathv is an array of matching pathnames //gl_pathc is the count of matches
-            numMatch; list++, numMatch--) {
-        length += strlen(*list) + 1;
-        length += 2; // allow room for space characters
+    for (list = result; *list != NULL; list++) {
+        length += strlen(*list) + 1; // room for the space or the terminator
     }
-    // use calloc here to ensure allocated buffer is initialised.
-    char * pathListString = calloc(length, 1);
+    char * pathListString = emalloc(length);
 
     // start appending the path names onto our return string
-    for (list = result.gl_pathv, numMatch = result.gl_pathc;
-            numMatch; list++, numMatch--) {
-        strcat(pathListString, *list);
-        if (numMatch > 1) { // add space between words
-            strcat(pathListString, " ");
-        }
+    char * cp = pathListString;
+    for (list = result; *list != NULL; list++) {
+        size_t len = strlen(*list);
+        memcpy(cp, *list, len);
+        cp += len;
+        *cp++ = ' '; // add space between words
     }
+    cp[-1] = '\0';
 
-    // free the memory allocated for our glob struct
-    globfree(&result);
+    freeGlobWalk(result);
     return pathListString;
 }
 
@@ -231,15 +290,29 @@ freelist(char **list)
 {
     int n;
     for (n = 0; list[n] != NULL; n++) {
-        free(list[n]);
+        efree(list[n]);
     }
-    free(list);
+    efree(list);
 //	char	**cp = list;
 //	while( *cp )
 //		free(*cp++);
 //	free(list);
 }
 
+/**
+ * free the tokens left behind after the first NULL in a list
+ * of n tokens, once redirection has cut the command short
+ */
+void trimlist(char **list, int n) {
+    int k = 0;
+    while (k < n && list[k] != NULL)
+        k++;
+    for (; k < n; k++) {
+        efree(list[k]);
+        list[k] = NULL;
+    }
+}
+
 /**
  * free the 2d list returned by splitlinePipe
  */
@@ -248,24 +321,9 @@ void free2dlist(char *** list) {
     for (i = 0; list[i] != NULL; i++) {
         int j;
         for (j = 0; list[i][j] != (void *)0; j++) {
-            free(list[i][j]);
+            efree(list[i][j]);
         }
-        free(list[i]);
+        efree(list[i]);
     }
-    free(list);
-}
-
-void * emalloc(size_t n)
-{
-	void *rv ;
-	if ( (rv = malloc(n)) == NULL )
-		fatal("out of memory","",1);
-	return rv;
-}
-void * erealloc(void *p, size_t n)
-{
-	void *rv;
-	if ( (rv = realloc(p,n)) == NULL )
-		fatal("realloc() failed","",1);
-	return rv;
+    efree(list);
 }